@@ -0,0 +1,92 @@
+#include "avl_combining_tree.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#if 1
+
+/*
+ * Write throughput for 1, 2, 4 and 8 threads, each inserting and
+ * erasing keys of its own residue class, once through combining_tree
+ * and once through a tree behind one mutex. The combining tree should
+ * gain with the thread count while the mutex stays flat or drops.
+ * Every run is checked against what the threads expect at the end.
+ */
+template<typename Write>
+double run(int threads, int ops, std::vector<std::set<int>>& owned, std::atomic<int>& failed, Write write)
+{
+	const int range = 1 << 16;
+	std::vector<std::thread> workers;
+	auto start = std::chrono::steady_clock::now();
+	for (int id = 0; id < threads; id++) {
+		workers.emplace_back([&, id]() {
+			std::mt19937 rng(id);
+			std::set<int>& mine = owned[id];
+			for (int i = 0; i < ops; i++) {
+				int k = static_cast<int>(rng() % range) * threads + id;
+				bool insert = rng() % 2;
+				if (write(insert, k) != (insert ? mine.insert(k).second : mine.erase(k) == 1)) {
+					failed++;
+				}
+			}
+		});
+	}
+	for (auto& w : workers) {
+		w.join();
+	}
+	std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+	return threads * ops / time.count();
+}
+
+std::size_t expected_size(const std::vector<std::set<int>>& owned)
+{
+	std::size_t n = 0;
+	for (auto& s : owned) {
+		n += s.size();
+	}
+	return n;
+}
+
+int main()
+{
+	const int ops = 200000;
+	std::atomic<int> failed(0);
+
+	std::cout << " threads  combining ops/s  mutex ops/s" << std::endl;
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		std::vector<std::set<int>> owned(threads);
+		avl::combining_tree<int> c;
+		double combined = run(threads, ops / threads, owned, failed, [&](bool insert, int k) {
+			return insert ? c.insert(k) : c.erase(k);
+		});
+		if (c.size() != expected_size(owned)) failed++;
+
+		std::vector<std::set<int>> owned2(threads);
+		avl::tree<int> t;
+		std::mutex m;
+		double locked = run(threads, ops / threads, owned2, failed, [&](bool insert, int k) {
+			std::lock_guard<std::mutex> lock(m);
+			std::size_t n = t.size();
+			if (insert) {
+				t.insert(k);
+			}
+			else {
+				t.remove(k);
+			}
+			return t.size() != n;
+		});
+		if (t.size() != expected_size(owned2)) failed++;
+
+		std::cout << " " << threads << "        " << static_cast<long>(combined)
+			<< "          " << static_cast<long>(locked) << std::endl;
+	}
+	std::cout << " " << failed << " failures" << std::endl;
+	return failed ? 1 : 0;
+}
+
+#endif
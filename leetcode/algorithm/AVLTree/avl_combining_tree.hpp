@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "avl_tree_plus.hpp"
+
+namespace avl {
+
+	/*
+	 * A tree shared by many writers through flat combining. A thread
+	 * doesn't queue on the lock with its one operation. It writes the
+	 * request into a slot and whoever gets the lock, the combiner, runs
+	 * every request posted so far, then the others just pick up their
+	 * results:
+	 *
+	 *   slots:  [ins 7] [find 2] [ins 3] [   ] [del 9]
+	 *              |       |        |             |
+	 *              +-------+--- sorted: 2 3 7 9 --+
+	 *                           applied in one pass
+	 *
+	 * The batch is sorted and every key is searched from a finger (see
+	 * tree::cursor), the last node found, instead of from the root. The
+	 * requests on one key are settled among themselves first, so what
+	 * is left to do is at most one node out and one node in per key.
+	 * Those writes are applied together: the nodes going out are cut
+	 * with one split and join recursion, the new ones are built into a
+	 * balanced subtree and merged with union_native(). An ancestor many
+	 * keys share is rebalanced once per batch, not once per request:
+	 *
+	 *   out: 3 9     tree = join(erase(tree < 3), erase(tree > 3))
+	 *   in:  2 7     tree = union(tree, [2 7])
+	 *
+	 * The lock and the top of the tree stay in the cache of one thread,
+	 * and a larger crowd makes larger batches rather than a longer queue.
+	 *
+	 * Slots are claimed and released like the reader slots of an
+	 * epoch_domain, so there are as many as threads ever posted at once.
+	 */
+	template<typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+	class combining_tree : private tree<T, Compare, Allocator> {
+		using base = tree<T, Compare, Allocator>;
+		using base_ptr = typename base::base_ptr;
+		using node_list = typename base::node_list;
+
+		enum class kind { insert, erase, find };
+
+		/* How often the combiner looks for more work before it leaves. */
+		static constexpr int combine_rounds = 4;
+
+		static constexpr int idle = 0;
+		static constexpr int pending = 1;
+		static constexpr int done = 2;
+
+		struct alignas(64) slot {
+			std::atomic<int> state{ idle };
+			std::atomic<bool> used{ false };
+			kind op = kind::find;
+			const T* key = nullptr;
+			T* movable = nullptr;         /* insert(T&&) may move from it */
+			std::optional<T>* out = nullptr;
+			bool result = false;
+			std::exception_ptr error;
+			slot* next = nullptr;
+		};
+
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using allocator_type = Allocator;
+
+		combining_tree() = default;
+
+		explicit combining_tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+			base(comp, alloc) {}
+
+		combining_tree(const combining_tree&) = delete;
+		combining_tree& operator=(const combining_tree&) = delete;
+
+		~combining_tree() noexcept {
+			for (auto s = head_.load(); s; ) {
+				auto temp = s->next;
+				delete s;
+				s = temp;
+			}
+		}
+
+		/* false if an equal element was there already. */
+		bool insert(const T& t) {
+			return post(kind::insert, &t, nullptr, nullptr);
+		}
+
+		bool insert(T&& t) {
+			return post(kind::insert, &t, &t, nullptr);
+		}
+
+		bool erase(const T& t) {
+			return post(kind::erase, &t, nullptr, nullptr);
+		}
+
+		bool contains(const T& t) {
+			return post(kind::find, &t, nullptr, nullptr);
+		}
+
+		/* A copy of the element equal to t, taken by the combiner. */
+		std::optional<T> find(const T& t) {
+			std::optional<T> res;
+			post(kind::find, &t, nullptr, &res);
+			return res;
+		}
+
+		size_type size() const {
+			std::lock_guard<std::mutex> lock(mutex_);
+			return base::size();
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		void clear() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			base::clear();
+		}
+
+		/* Run f on the underlying tree with the combiner lock held. */
+		template<typename F>
+		decltype(auto) apply(F&& f) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			return f(static_cast<const base&>(*this));
+		}
+
+	private:
+		/*
+		 * Publish the request, then either find it done or take the lock
+		 * and combine. The caller's key stays alive meanwhile, so the
+		 * slot only points at it.
+		 */
+		bool post(kind op, const T* key, T* movable, std::optional<T>* out) {
+			slot* s = acquire_slot();
+			s->op = op;
+			s->key = key;
+			s->movable = movable;
+			s->out = out;
+			s->error = nullptr;
+			s->state.store(pending, std::memory_order_release);
+			while (s->state.load(std::memory_order_acquire) != done) {
+				if (mutex_.try_lock()) {
+					std::lock_guard<std::mutex> lock(mutex_, std::adopt_lock);
+					combine();
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+			bool res = s->result;
+			std::exception_ptr error = std::move(s->error);
+			s->state.store(idle, std::memory_order_relaxed);
+			s->used.store(false, std::memory_order_release);
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return res;
+		}
+
+		slot* acquire_slot() {
+			for (auto s = head_.load(std::memory_order_acquire); s; s = s->next) {
+				if (!s->used.load(std::memory_order_relaxed) &&
+					!s->used.exchange(true, std::memory_order_acquire)) {
+					return s;
+				}
+			}
+			slot* s = new slot;
+			s->used.store(true, std::memory_order_relaxed);
+			s->next = head_.load(std::memory_order_relaxed);
+			while (!head_.compare_exchange_weak(s->next, s,
+				std::memory_order_release, std::memory_order_relaxed)) {}
+			return s;
+		}
+
+		/* mutex_ is held. */
+		void combine() {
+			for (int round = 0; round < combine_rounds; round++) {
+				batch_.clear();
+				for (auto s = head_.load(std::memory_order_acquire); s; s = s->next) {
+					if (s->state.load(std::memory_order_acquire) == pending) {
+						batch_.push_back(s);
+					}
+				}
+				if (batch_.empty()) return;
+				std::stable_sort(batch_.begin(), batch_.end(), [this](slot* a, slot* b) {
+					return this->comp_(*a->key, *b->key);
+				});
+				try {
+					run_batch();
+				}
+				catch (...) {
+					for (auto s : batch_) {
+						s->error = std::current_exception();
+					}
+				}
+				for (auto s : batch_) {
+					s->state.store(done, std::memory_order_release);
+				}
+			}
+		}
+
+		/* Settle every key of the sorted batch, then write them at once. */
+		void run_batch() {
+			outgoing_.clear();
+			incoming_.clear();
+			base_ptr finger = nullptr;
+			for (size_type i = 0; i < batch_.size(); ) {
+				size_type j = i + 1;
+				while (j < batch_.size() && !this->comp_(*batch_[i]->key, *batch_[j]->key)) {
+					j++;
+				}
+				settle(i, j, finger);
+				i = j;
+			}
+			if (outgoing_.size() + incoming_.size() == 1) {
+				/* A lone write has no ancestors to share. */
+				if (!outgoing_.empty()) {
+					base::erase(typename base::iterator(outgoing_[0]));
+				}
+				else {
+					base_ptr parent;
+					bool left;
+					this->locate(this->root_, incoming_[0]->as_node()->data, parent, left);
+					this->link_leaf(incoming_[0], parent, left);
+				}
+				return;
+			}
+			if (!outgoing_.empty()) {
+				this->root_ = erase_sorted(this->root_, outgoing_.data(), outgoing_.size());
+				for (auto node : outgoing_) {
+					this->destroy_node(node);
+				}
+			}
+			if (!incoming_.empty()) {
+				node_list dead;
+				base_ptr batch = link_sorted(incoming_.data(), incoming_.size());
+				this->root_ = this->union_native(this->root_, batch, dead);
+				for (auto node = dead.head; node; ) {
+					auto next = node->parent;
+					this->destroy_subtree(node);
+					node = next;
+				}
+			}
+			this->size_ = this->root_ ? this->root_->size : 0;
+		}
+
+		/*
+		 * The requests of batch_[first, last) share a key. They run in
+		 * order against whether the key is there, which takes a single
+		 * search. At the end the node found may have to go and the
+		 * element of the last insert that counted may have to come in.
+		 * If that one can't be built, the whole key fails together.
+		 */
+		void settle(size_type first, size_type last, base_ptr& finger) {
+			base_ptr found = nullptr;
+			slot* value = nullptr;
+			bool present = false;
+			bool drop = false;
+			try {
+				const T& key = *batch_[first]->key;
+				base_ptr parent;
+				bool left;
+				found = finger ? this->finger_locate(finger, key, parent, left)
+					: this->locate(this->root_, key, parent, left);
+				finger = found ? found : parent;
+				present = found != nullptr;
+				for (size_type i = first; i < last; i++) {
+					slot& s = *batch_[i];
+					switch (s.op) {
+					case kind::insert:
+						s.result = !present;
+						if (!present) {
+							present = true;
+							value = &s;
+						}
+						break;
+					case kind::erase:
+						s.result = present;
+						if (present && !value) {
+							drop = true;
+						}
+						present = false;
+						value = nullptr;
+						break;
+					default:
+						s.result = present;
+						if (present && s.out) {
+							try {
+								*s.out = value ? *value->key : found->as_node()->data;
+							}
+							catch (...) {
+								s.error = std::current_exception();
+							}
+						}
+						break;
+					}
+				}
+				if (value) {
+					incoming_.push_back(value->movable ? this->create_node(std::move(*value->movable))
+						: this->create_node(*value->key));
+				}
+			}
+			catch (...) {
+				for (size_type i = first; i < last; i++) {
+					batch_[i]->error = std::current_exception();
+				}
+				return;
+			}
+			if (drop) {
+				outgoing_.push_back(found);
+			}
+		}
+
+		/*
+		 * Cut the n ascending nodes of 'out' from a detached subtree:
+		 * split at the middle one, which comes back detached, recurse
+		 * into both sides and join them again.
+		 */
+		base_ptr erase_sorted(base_ptr node, base_ptr* out, size_type n) const {
+			if (!node || !n) return node;
+			size_type mid = n / 2;
+			base_ptr l, r;
+			this->split_native(node, out[mid]->as_node()->data, l, r);
+			l = erase_sorted(l, out, mid);
+			r = erase_sorted(r, out + mid + 1, n - mid - 1);
+			return base::join2_native(l, r);
+		}
+
+		/* Link n ascending detached nodes into a balanced subtree. */
+		static base_ptr link_sorted(base_ptr* nodes, size_type n) {
+			if (!n) return nullptr;
+			size_type mid = n / 2;
+			base_ptr node = nodes[mid];
+			node->left = link_sorted(nodes, mid);
+			node->right = link_sorted(nodes + mid + 1, n - mid - 1);
+			if (node->left) node->left->parent = node;
+			if (node->right) node->right->parent = node;
+			node->update_height();
+			return node;
+		}
+
+		mutable std::mutex mutex_;
+		std::atomic<slot*> head_{ nullptr };
+		/* Only touched by the combiner. */
+		std::vector<slot*> batch_;
+		std::vector<base_ptr> outgoing_;
+		std::vector<base_ptr> incoming_;
+	};
+}
@@ -0,0 +1,583 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace avl {
+
+	/*
+	 * Storages for compact_tree. Nodes live in one vector and link to
+	 * each other by 32-bit slot indices, so the whole tree is a single
+	 * allocation and up to 2^32 - 1 keys fit. There are no parent
+	 * links, insert and remove keep the descent path instead.
+	 *
+	 * packed_storage keeps a node in one piece, for int keys:
+	 *
+	 *   [ key 4 | left 4 | right 4 | h 1 | pad 3 ]    16 bytes
+	 *
+	 * split_storage moves the height, which a lookup never reads, out
+	 * to its own array, so the hot array holds keys and links only:
+	 *
+	 *   hot:  [ key 4 | left 4 | right 4 ]            12 bytes
+	 *   cold: [ h 1 ]                                  1 byte
+	 */
+	template<typename T>
+	class packed_storage {
+	public:
+		using index_type = std::uint32_t;
+
+		T& data(index_type i) noexcept { return nodes_[i].data; }
+
+		const T& data(index_type i) const noexcept { return nodes_[i].data; }
+
+		index_type& left(index_type i) noexcept { return nodes_[i].left; }
+
+		index_type left(index_type i) const noexcept { return nodes_[i].left; }
+
+		index_type& right(index_type i) noexcept { return nodes_[i].right; }
+
+		index_type right(index_type i) const noexcept { return nodes_[i].right; }
+
+		std::int8_t& height(index_type i) noexcept { return nodes_[i].height; }
+
+		std::int8_t height(index_type i) const noexcept { return nodes_[i].height; }
+
+		/* Append a slot, the caller sets up its links. */
+		template<typename V>
+		index_type push(V&& v) {
+			nodes_.push_back(node{ T(std::forward<V>(v)), 0, 0, 0 });
+			return static_cast<index_type>(nodes_.size() - 1);
+		}
+
+		std::size_t slots() const noexcept { return nodes_.size(); }
+
+		void reserve(std::size_t n) { nodes_.reserve(n); }
+
+		void clear() noexcept { nodes_.clear(); }
+
+	private:
+		struct node {
+			T data;
+			index_type left;
+			index_type right;
+			std::int8_t height;
+		};
+
+		std::vector<node> nodes_;
+
+	public:
+		static constexpr std::size_t bytes_per_node = sizeof(node);
+	};
+
+	template<typename T>
+	class split_storage {
+	public:
+		using index_type = std::uint32_t;
+
+		T& data(index_type i) noexcept { return hot_[i].data; }
+
+		const T& data(index_type i) const noexcept { return hot_[i].data; }
+
+		index_type& left(index_type i) noexcept { return hot_[i].left; }
+
+		index_type left(index_type i) const noexcept { return hot_[i].left; }
+
+		index_type& right(index_type i) noexcept { return hot_[i].right; }
+
+		index_type right(index_type i) const noexcept { return hot_[i].right; }
+
+		std::int8_t& height(index_type i) noexcept { return height_[i]; }
+
+		std::int8_t height(index_type i) const noexcept { return height_[i]; }
+
+		template<typename V>
+		index_type push(V&& v) {
+			height_.push_back(0);
+			try {
+				hot_.push_back(hot{ T(std::forward<V>(v)), 0, 0 });
+			}
+			catch (...) {
+				height_.pop_back();
+				throw;
+			}
+			return static_cast<index_type>(hot_.size() - 1);
+		}
+
+		std::size_t slots() const noexcept { return hot_.size(); }
+
+		void reserve(std::size_t n) {
+			hot_.reserve(n);
+			height_.reserve(n);
+		}
+
+		void clear() noexcept {
+			hot_.clear();
+			height_.clear();
+		}
+
+	private:
+		struct hot {
+			T data;
+			index_type left;
+			index_type right;
+		};
+
+		std::vector<hot> hot_;
+		std::vector<std::int8_t> height_;
+
+	public:
+		static constexpr std::size_t bytes_per_node = sizeof(hot) + sizeof(std::int8_t);
+	};
+
+	/*
+	 * An AVL set of T for big, memory bound indexes. Same rotations and
+	 * the same one comparison per level as tree, but nodes are slots of
+	 * a Storage (see above) instead of allocations, and a removed slot
+	 * is kept on a free list chained through its left link for the next
+	 * insert. Keys may move between slots when a node with two children
+	 * is removed, so no reference to an element survives a remove.
+	 *
+	 * Without parent links the way back up is the path recorded on the
+	 * way down. An AVL tree of n nodes is shorter than 1.44 log2(n + 2),
+	 * so 48 entries cover every tree 32-bit indices can address.
+	 */
+	template<typename T, typename Compare = std::less<T>, typename Storage = packed_storage<T>>
+	class compact_tree {
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using storage_type = Storage;
+		using index_type = typename Storage::index_type;
+
+		static constexpr index_type nil = static_cast<index_type>(-1);
+		static constexpr int max_height = 48;
+
+		class const_iterator {
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() noexcept :
+				tree_(nullptr),
+				depth_(0) {}
+
+			reference operator*() const noexcept {
+				return tree_->store_.data(stack_[depth_ - 1]);
+			}
+
+			pointer operator->() const noexcept {
+				return &**this;
+			}
+
+			/*
+			 * The stack holds the nodes whose left subtree is being
+			 * visited, the top one is the current node.
+			 */
+			const_iterator& operator++() noexcept {
+				index_type node = tree_->store_.right(stack_[--depth_]);
+				push_left(node);
+				return *this;
+			}
+
+			const_iterator operator++(int) noexcept {
+				const_iterator temp = *this;
+				++*this;
+				return temp;
+			}
+
+			bool operator==(const const_iterator& rhs) const noexcept {
+				return depth_ == rhs.depth_ &&
+					(!depth_ || stack_[depth_ - 1] == rhs.stack_[depth_ - 1]);
+			}
+
+			bool operator!=(const const_iterator& rhs) const noexcept {
+				return !(*this == rhs);
+			}
+
+		private:
+			friend class compact_tree;
+
+			explicit const_iterator(const compact_tree* tree) noexcept :
+				tree_(tree),
+				depth_(0) {}
+
+			void push_left(index_type node) noexcept {
+				while (node != nil) {
+					stack_[depth_++] = node;
+					node = tree_->store_.left(node);
+				}
+			}
+
+			const compact_tree* tree_;
+			int depth_;
+			index_type stack_[max_height];
+		};
+
+		using iterator = const_iterator;
+
+		compact_tree() :
+			root_(nil),
+			free_(nil),
+			size_(0) {}
+
+		explicit compact_tree(const Compare& comp) :
+			root_(nil),
+			free_(nil),
+			size_(0),
+			comp_(comp) {}
+
+		template<typename InputIt>
+		compact_tree(InputIt first, InputIt last, const Compare& comp = Compare()) :
+			compact_tree(comp) {
+			for (; first != last; ++first) {
+				insert(*first);
+			}
+		}
+
+		compact_tree(std::initializer_list<T> il, const Compare& comp = Compare()) :
+			compact_tree(il.begin(), il.end(), comp) {}
+
+		/* Links are indices, so a copy of the storage is a copy of the tree. */
+		compact_tree(const compact_tree&) = default;
+		compact_tree& operator=(const compact_tree&) = default;
+
+		compact_tree(compact_tree&& rhs) noexcept :
+			root_(rhs.root_),
+			free_(rhs.free_),
+			size_(rhs.size_),
+			comp_(std::move(rhs.comp_)),
+			store_(std::move(rhs.store_)) {
+			rhs.clear();
+		}
+
+		compact_tree& operator=(compact_tree&& rhs) noexcept {
+			if (this != &rhs) {
+				root_ = rhs.root_;
+				free_ = rhs.free_;
+				size_ = rhs.size_;
+				comp_ = std::move(rhs.comp_);
+				store_ = std::move(rhs.store_);
+				rhs.clear();
+			}
+			return *this;
+		}
+
+		key_compare key_comp() const { return comp_; }
+
+		bool empty() const noexcept {
+			return size_ == 0;
+		}
+
+		size_type size() const noexcept {
+			return size_;
+		}
+
+		/* Slots are reused, so this is also the highest size ever reached. */
+		size_type slots() const noexcept {
+			return store_.slots();
+		}
+
+		void reserve(size_type n) {
+			store_.reserve(n);
+		}
+
+		void clear() noexcept {
+			store_.clear();
+			reset();
+		}
+
+		const_iterator begin() const noexcept {
+			const_iterator it(this);
+			it.push_left(root_);
+			return it;
+		}
+
+		const_iterator end() const noexcept {
+			return const_iterator(this);
+		}
+
+		bool insert(const T& t) {
+			return insert_native(t);
+		}
+
+		bool insert(T&& t) {
+			return insert_native(std::move(t));
+		}
+
+		/* Return true when t was found and removed. */
+		bool remove(const T& t) {
+			return remove_native(t);
+		}
+
+		bool contains(const T& t) const {
+			return find(t) != nullptr;
+		}
+
+		/* The stored element equal to t, or null. */
+		const T* find(const T& t) const {
+			index_type node = root_, cand = nil;
+			while (node != nil) {
+				if (comp_(t, store_.data(node))) {
+					node = store_.left(node);
+				}
+				else {
+					cand = node;
+					node = store_.right(node);
+				}
+			}
+			return cand != nil && !comp_(store_.data(cand), t) ? &store_.data(cand) : nullptr;
+		}
+
+		int height() const noexcept {
+			return get_height(root_);
+		}
+
+		void swap(compact_tree& rhs) noexcept {
+			std::swap(root_, rhs.root_);
+			std::swap(free_, rhs.free_);
+			std::swap(size_, rhs.size_);
+			std::swap(comp_, rhs.comp_);
+			std::swap(store_, rhs.store_);
+		}
+
+	private:
+		/*
+		 * Same descent as tree::locate(): only 'key < data' is asked on
+		 * the way down and equality is checked once at the bottom.
+		 */
+		template<typename V>
+		bool insert_native(V&& t) {
+			index_type path[max_height];
+			int depth = 0;
+			bool left = false;
+			index_type node = root_, cand = nil;
+			while (node != nil) {
+				path[depth++] = node;
+				left = comp_(t, store_.data(node));
+				if (left) {
+					node = store_.left(node);
+				}
+				else {
+					cand = node;
+					node = store_.right(node);
+				}
+			}
+			if (cand != nil && !comp_(store_.data(cand), t)) {
+				return false;
+			}
+
+			index_type res = new_node(std::forward<V>(t));
+			if (!depth) {
+				root_ = res;
+				return true;
+			}
+			if (left) {
+				store_.left(path[depth - 1]) = res;
+			}
+			else {
+				store_.right(path[depth - 1]) = res;
+			}
+			rebalance_path(path, depth);
+			return true;
+		}
+
+		/*
+		 * After the descent for an existing key the path goes on from
+		 * the equal node into its right subtree and always left there,
+		 * so it ends on the successor. Move the successor's key up and
+		 * unlink the successor, which has no left child:
+		 *
+		 *          4  <- cand           5
+		 *         / \                  / \
+		 *        2   7        =>      2   7
+		 *       /   / \              /     \
+		 *      1   5   8            1       8
+		 *          ^ last
+		 *
+		 * When the equal node has no right child it is the last one on
+		 * the path and is unlinked itself, handing over its left child.
+		 */
+		template<typename K>
+		bool remove_native(const K& key) {
+			index_type path[max_height];
+			int depth = 0;
+			index_type node = root_, cand = nil;
+			while (node != nil) {
+				path[depth++] = node;
+				if (comp_(key, store_.data(node))) {
+					node = store_.left(node);
+				}
+				else {
+					cand = node;
+					node = store_.right(node);
+				}
+			}
+			if (cand == nil || comp_(store_.data(cand), key)) {
+				return false;
+			}
+
+			index_type last = path[--depth];
+			if (last != cand) {
+				store_.data(cand) = std::move(store_.data(last));
+			}
+			index_type child = store_.left(last) != nil ? store_.left(last) : store_.right(last);
+			if (!depth) {
+				root_ = child;
+			}
+			else if (store_.left(path[depth - 1]) == last) {
+				store_.left(path[depth - 1]) = child;
+			}
+			else {
+				store_.right(path[depth - 1]) = child;
+			}
+			free_node(last);
+			rebalance_path(path, depth);
+			return true;
+		}
+
+		/*
+		 * Fix heights and balance from the bottom of the path up. Once a
+		 * subtree keeps its old height nothing above it changes.
+		 */
+		void rebalance_path(const index_type* path, int depth) {
+			while (depth--) {
+				index_type node = path[depth];
+				int old = store_.height(node);
+				index_type top = rebalance(node);
+				if (top != node) {
+					if (!depth) {
+						root_ = top;
+					}
+					else if (store_.left(path[depth - 1]) == node) {
+						store_.left(path[depth - 1]) = top;
+					}
+					else {
+						store_.right(path[depth - 1]) = top;
+					}
+				}
+				if (store_.height(top) == old) {
+					break;
+				}
+			}
+		}
+
+		/* Return the new top of the subtree of node. */
+		index_type rebalance(index_type node) {
+			update_height(node);
+			int factor = get_height(store_.left(node)) - get_height(store_.right(node));
+			if (factor > 1) {
+				index_type l = store_.left(node);
+				if (get_height(store_.left(l)) < get_height(store_.right(l))) {
+					store_.left(node) = rotate_left(l);
+				}
+				return rotate_right(node);
+			}
+			if (factor < -1) {
+				index_type r = store_.right(node);
+				if (get_height(store_.right(r)) < get_height(store_.left(r))) {
+					store_.right(node) = rotate_right(r);
+				}
+				return rotate_left(node);
+			}
+			return node;
+		}
+
+		/*
+		 *        node            l
+		 *        /  \           / \
+		 *       l    c   =>    a  node
+		 *      / \                /  \
+		 *     a   b              b    c
+		 */
+		index_type rotate_right(index_type node) {
+			index_type l = store_.left(node);
+			store_.left(node) = store_.right(l);
+			store_.right(l) = node;
+			update_height(node);
+			update_height(l);
+			return l;
+		}
+
+		index_type rotate_left(index_type node) {
+			index_type r = store_.right(node);
+			store_.right(node) = store_.left(r);
+			store_.left(r) = node;
+			update_height(node);
+			update_height(r);
+			return r;
+		}
+
+		int get_height(index_type node) const noexcept {
+			return node == nil ? 0 : store_.height(node);
+		}
+
+		void update_height(index_type node) noexcept {
+			int l = get_height(store_.left(node));
+			int r = get_height(store_.right(node));
+			store_.height(node) = static_cast<std::int8_t>(1 + (l > r ? l : r));
+		}
+
+		template<typename V>
+		index_type new_node(V&& t) {
+			index_type res;
+			if (free_ != nil) {
+				res = free_;
+				store_.data(res) = std::forward<V>(t);
+				free_ = store_.left(res);
+			}
+			else {
+				if (store_.slots() >= nil) {
+					throw std::length_error("compact_tree is out of indices");
+				}
+				res = store_.push(std::forward<V>(t));
+			}
+			store_.left(res) = nil;
+			store_.right(res) = nil;
+			store_.height(res) = 1;
+			size_++;
+			return res;
+		}
+
+		/* A free slot keeps no resources of its old key. */
+		void free_node(index_type node) {
+			if constexpr (!std::is_trivially_destructible<T>::value &&
+				std::is_default_constructible<T>::value) {
+				store_.data(node) = T();
+			}
+			store_.left(node) = free_;
+			free_ = node;
+			size_--;
+		}
+
+		void reset() noexcept {
+			root_ = nil;
+			free_ = nil;
+			size_ = 0;
+		}
+
+		index_type root_;  /* slot of the root, nil when empty */
+		index_type free_;  /* head of the free slots */
+		size_type size_;
+		Compare comp_;
+		Storage store_;
+	};
+
+	/* Hot keys and links in one array, heights in another. */
+	template<typename T, typename Compare = std::less<T>>
+	using split_compact_tree = compact_tree<T, Compare, split_storage<T>>;
+
+	template<typename T, typename C, typename S>
+	void swap(compact_tree<T, C, S>& lhs, compact_tree<T, C, S>& rhs) noexcept {
+		lhs.swap(rhs);
+	}
+}
@@ -0,0 +1,69 @@
+#include "avl_concurrent_tree.hpp"
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#if 1
+
+/*
+ * Each thread owns the keys k with k % threads == id, so it knows what
+ * its own keys should look like, while all of them share a range small
+ * enough that they keep rebalancing the same nodes.
+ */
+int main()
+{
+	const int threads = 4;
+	const int range = 256;
+	const int rounds = 100000;
+
+	avl::concurrent_tree<int> t;
+	std::vector<std::set<int>> owned(threads);
+	std::vector<int> errors(threads, 0);
+
+	std::vector<std::thread> workers;
+	for (int id = 0; id < threads; id++) {
+		workers.emplace_back([&, id]() {
+			std::mt19937 rng(id);
+			std::set<int>& mine = owned[id];
+			for (int i = 0; i < rounds; i++) {
+				int k = static_cast<int>(rng() % range) * threads + id;
+				if (rng() % 2) {
+					if (t.insert(k) != mine.insert(k).second) errors[id]++;
+				}
+				else {
+					if (t.remove(k) != (mine.erase(k) == 1)) errors[id]++;
+				}
+			}
+		});
+	}
+	for (auto& w : workers) {
+		w.join();
+	}
+
+	std::set<int> expected;
+	int failed = 0;
+	for (int id = 0; id < threads; id++) {
+		expected.insert(owned[id].begin(), owned[id].end());
+		failed += errors[id];
+	}
+
+	for (int k = 0; k < range * threads; k++) {
+		if (t.contains(k) != (expected.count(k) == 1)) failed++;
+	}
+
+	std::size_t count = 0;
+	int prev = -1;
+	for (int v : t) {
+		if (v <= prev) failed++;
+		prev = v;
+		count++;
+	}
+	if (count != t.size() || count != expected.size()) failed++;
+
+	std::cout << " " << t.size() << " keys, " << failed << " failures" << std::endl;
+	return failed ? 1 : 0;
+}
+
+#endif
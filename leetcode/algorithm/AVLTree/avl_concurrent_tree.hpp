@@ -0,0 +1,761 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avl_epoch.hpp"
+
+namespace avl {
+
+	/* Test and test-and-set, a byte per node. */
+	class spin_lock {
+	public:
+		void lock() noexcept {
+			while (flag_.exchange(true, std::memory_order_acquire)) {
+				while (flag_.load(std::memory_order_relaxed)) {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		void unlock() noexcept {
+			flag_.store(false, std::memory_order_release);
+		}
+
+	private:
+		std::atomic<bool> flag_{ false };
+	};
+
+	/*
+	 * child[0] is the left child and child[1] the right one, so every
+	 * rotation is written once for both directions. A node that isn't
+	 * 'present' is a routing node: its key only steers searches.
+	 */
+	struct concurrent_node_base {
+		std::atomic<concurrent_node_base*> child[2];
+		std::atomic<concurrent_node_base*> parent;
+		std::atomic<std::uint64_t> version;
+		std::atomic<int> height;
+		std::atomic<bool> present;
+		spin_lock lock;
+
+		explicit concurrent_node_base(concurrent_node_base* p = nullptr, bool pr = false) noexcept :
+			child{ { nullptr }, { nullptr } },
+			parent(p),
+			version(0),
+			height(1),
+			present(pr) {}
+	};
+
+	template<typename T>
+	struct concurrent_node : public concurrent_node_base {
+		template<typename V>
+		concurrent_node(V&& t, concurrent_node_base* p) :
+			concurrent_node_base(p, true),
+			data(std::forward<V>(t)) {}
+
+		const T data;
+	};
+
+	/*
+	 * A concurrent AVL set after Bronson, Casper, Chafi and Olukotun,
+	 * "A Practical Concurrent Binary Search Tree" (PPoPP 2010).
+	 *
+	 * Readers take no lock. Each node has a version that a rotation
+	 * marks 'shrinking' while it moves the node down and bumps when it
+	 * is done. A search reads the child link, then checks that the
+	 * version of the parent didn't change, hand over hand:
+	 *
+	 *      p (v=8)       read p.child -> c, read c.version, then check
+	 *     /              p.version is still 8. If so, c's subtree still
+	 *    c               covers the key and the search goes on in c.
+	 *                    Otherwise step back to p and read again.
+	 *
+	 * Writers lock the few nodes they change, always parent before
+	 * child. A removed node with two children only becomes a routing
+	 * node (partially external tree), it is spliced out later once it
+	 * has one child left. Heights are fixed and rotations done on the
+	 * way back up with local locks, so balance is relaxed for a moment
+	 * under contention and restored by whoever touches the node next.
+	 *
+	 * Unlinked nodes are freed through an epoch_domain, every operation
+	 * pins it. Iterators hold a copy of their element and step with a
+	 * validated successor search, so they are weakly consistent and
+	 * never invalid: they see every element present during the whole
+	 * walk and may or may not see concurrent changes.
+	 */
+	template<typename T, typename Compare = std::less<T>>
+	class concurrent_tree {
+		using base_ptr = concurrent_node_base*;
+		using node_ptr = concurrent_node<T>*;
+
+		static constexpr std::uint64_t unlinked = 1;
+		static constexpr std::uint64_t shrinking = 2;
+
+		/* Results of one attempt, 'retry' restarts from the level above. */
+		enum class op { retry, yes, no };
+
+		/* node_condition() results, anything else is a new height. */
+		static constexpr int unlink_required = -1;
+		static constexpr int rebalance_required = -2;
+		static constexpr int nothing_required = -3;
+
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+
+		class const_iterator {
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() noexcept :
+				tree_(nullptr) {}
+
+			reference operator*() const noexcept { return *cur_; }
+
+			pointer operator->() const noexcept { return &*cur_; }
+
+			const_iterator& operator++() {
+				cur_ = tree_->successor(&*cur_, true);
+				return *this;
+			}
+
+			const_iterator operator++(int) {
+				const_iterator temp = *this;
+				++*this;
+				return temp;
+			}
+
+			bool operator==(const const_iterator& rhs) const {
+				if (!cur_ || !rhs.cur_) {
+					return !cur_ && !rhs.cur_;
+				}
+				return !tree_->comp_(*cur_, *rhs.cur_) && !tree_->comp_(*rhs.cur_, *cur_);
+			}
+
+			bool operator!=(const const_iterator& rhs) const {
+				return !(*this == rhs);
+			}
+
+		private:
+			friend class concurrent_tree;
+
+			const_iterator(const concurrent_tree* tree, std::optional<T>&& cur) :
+				tree_(tree),
+				cur_(std::move(cur)) {}
+
+			const concurrent_tree* tree_;
+			std::optional<T> cur_;
+		};
+
+		using iterator = const_iterator;
+
+		concurrent_tree() :
+			size_(0) {}
+
+		explicit concurrent_tree(const Compare& comp) :
+			size_(0),
+			comp_(comp) {}
+
+		concurrent_tree(const concurrent_tree&) = delete;
+		concurrent_tree& operator=(const concurrent_tree&) = delete;
+
+		/* Nothing may run on the tree any more. */
+		~concurrent_tree() noexcept {
+			destroy_subtree(holder_.child[1].load());
+		}
+
+		key_compare key_comp() const { return comp_; }
+
+		/* Exact when the tree is quiet, a recent value otherwise. */
+		size_type size() const noexcept {
+			return size_.load(std::memory_order_relaxed);
+		}
+
+		bool empty() const noexcept {
+			return size() == 0;
+		}
+
+		const_iterator begin() const {
+			return const_iterator(this, successor(nullptr, false));
+		}
+
+		const_iterator end() const noexcept {
+			return const_iterator(this, std::nullopt);
+		}
+
+		const_iterator find(const T& t) const {
+			auto g = domain_.pin();
+			base_ptr found = get_native(t);
+			return found ? const_iterator(this, std::optional<T>(data_of(found))) : end();
+		}
+
+		/* The first element not less than t. */
+		const_iterator lower_bound(const T& t) const {
+			return const_iterator(this, successor(&t, false));
+		}
+
+		bool contains(const T& t) const {
+			auto g = domain_.pin();
+			return get_native(t) != nullptr;
+		}
+
+		/* Return true when t wasn't there yet. */
+		bool insert(const T& t) {
+			return insert_native(t);
+		}
+
+		bool insert(T&& t) {
+			return insert_native(std::move(t));
+		}
+
+		/* Return true when t was there and is removed. */
+		bool remove(const T& t) {
+			auto g = domain_.pin();
+			while (1) {
+				op res = attempt_remove(t, &holder_, 1, holder_.version.load());
+				if (res != op::retry) {
+					return res == op::yes;
+				}
+			}
+		}
+
+	private:
+		static const T& data_of(base_ptr n) noexcept {
+			return static_cast<node_ptr>(n)->data;
+		}
+
+		static int get_height(base_ptr n) noexcept {
+			return n ? n->height.load() : 0;
+		}
+
+		/* The side of node to look for key in, or -1 when it's node. */
+		int side_of(const T& key, base_ptr node) const {
+			if (comp_(key, data_of(node))) return 0;
+			if (comp_(data_of(node), key)) return 1;
+			return -1;
+		}
+
+		/*
+		 * A rotation holds the lock of a shrinking node the whole time,
+		 * so after a short spin wait on the lock.
+		 */
+		static void wait_until_not_changing(base_ptr n) {
+			for (int i = 0; i < 64; i++) {
+				if (!(n->version.load() & shrinking)) return;
+			}
+			std::lock_guard<spin_lock> lock(n->lock);
+		}
+
+		base_ptr get_native(const T& key) const {
+			while (1) {
+				base_ptr found = nullptr;
+				op res = attempt_get(key, const_cast<base_ptr>(&holder_), 1,
+					holder_.version.load(), found);
+				if (res != op::retry) {
+					return found;
+				}
+			}
+		}
+
+		/* Search the subtree at node->child[side], valid while node is at node_v. */
+		op attempt_get(const T& key, base_ptr node, int side, std::uint64_t node_v,
+			base_ptr& found) const {
+			while (1) {
+				base_ptr child = node->child[side].load();
+				if (node->version.load() != node_v) return op::retry;
+				if (!child) return op::no;
+				int next = side_of(key, child);
+				if (next < 0) {
+					if (!child->present.load()) return op::no;
+					found = child;
+					return op::yes;
+				}
+				std::uint64_t child_v = child->version.load();
+				if (child_v & shrinking) {
+					wait_until_not_changing(child);
+				}
+				else if (child_v != unlinked && child == node->child[side].load()) {
+					if (node->version.load() != node_v) return op::retry;
+					op res = attempt_get(key, child, next, child_v, found);
+					if (res != op::retry) return res;
+				}
+			}
+		}
+
+		/*
+		 * The least present element after *key (or not before it when
+		 * strict is false, or the least one when key is null). A routing
+		 * node found on the way is skipped by searching past its key.
+		 */
+		std::optional<T> successor(const T* key, bool strict) const {
+			auto g = domain_.pin();
+			while (1) {
+				base_ptr res;
+				bool retry;
+				do {
+					retry = false;
+					res = attempt_bound(key, strict, const_cast<base_ptr>(&holder_), 1,
+						holder_.version.load(), nullptr, retry);
+				} while (retry);
+				if (!res) return std::nullopt;
+				if (res->present.load()) return data_of(res);
+				key = &data_of(res);
+				strict = true;
+			}
+		}
+
+		/*
+		 * Like attempt_get(), 'best' is the lowest node above key seen
+		 * on the way down, the answer when the search falls off.
+		 */
+		base_ptr attempt_bound(const T* key, bool strict, base_ptr node, int side,
+			std::uint64_t node_v, base_ptr best, bool& retry) const {
+			while (1) {
+				base_ptr child = node->child[side].load();
+				if (node->version.load() != node_v) {
+					retry = true;
+					return nullptr;
+				}
+				if (!child) return best;
+				int next = key ? side_of(*key, child) : 0;
+				if (next < 0) {
+					if (!strict) return child;
+					next = 1;
+				}
+				std::uint64_t child_v = child->version.load();
+				if (child_v & shrinking) {
+					wait_until_not_changing(child);
+				}
+				else if (child_v != unlinked && child == node->child[side].load()) {
+					if (node->version.load() != node_v) {
+						retry = true;
+						return nullptr;
+					}
+					bool again = false;
+					base_ptr res = attempt_bound(key, strict, child, next, child_v,
+						next ? best : child, again);
+					if (!again) return res;
+				}
+			}
+		}
+
+		template<typename V>
+		bool insert_native(V&& t) {
+			auto g = domain_.pin();
+			while (1) {
+				op res = attempt_insert(t, &holder_, 1, holder_.version.load());
+				if (res != op::retry) {
+					return res == op::yes;
+				}
+			}
+		}
+
+		template<typename V>
+		op attempt_insert(V& t, base_ptr node, int side, std::uint64_t node_v) {
+			while (1) {
+				base_ptr child = node->child[side].load();
+				if (node->version.load() != node_v) return op::retry;
+				op res = op::retry;
+				if (!child) {
+					res = attempt_insert_into_empty(t, node, side, node_v);
+				}
+				else {
+					int next = side_of(t, child);
+					if (next < 0) {
+						res = attempt_make_present(child);
+					}
+					else {
+						std::uint64_t child_v = child->version.load();
+						if (child_v & shrinking) {
+							wait_until_not_changing(child);
+						}
+						else if (child_v != unlinked && child == node->child[side].load()) {
+							if (node->version.load() != node_v) return op::retry;
+							res = attempt_insert(t, child, next, child_v);
+						}
+					}
+				}
+				if (res != op::retry) return res;
+			}
+		}
+
+		template<typename V>
+		op attempt_insert_into_empty(V& t, base_ptr node, int side, std::uint64_t node_v) {
+			{
+				std::lock_guard<spin_lock> lock(node->lock);
+				if (node->version.load() != node_v || node->child[side].load()) {
+					return op::retry;
+				}
+				node->child[side].store(new concurrent_node<T>(std::forward<V>(t), node));
+			}
+			size_.fetch_add(1, std::memory_order_relaxed);
+			fix_height_and_rebalance(node);
+			return op::yes;
+		}
+
+		/* An equal routing node becomes present again. */
+		op attempt_make_present(base_ptr n) {
+			std::lock_guard<spin_lock> lock(n->lock);
+			if (n->version.load() == unlinked) return op::retry;
+			if (n->present.load()) return op::no;
+			n->present.store(true);
+			size_.fetch_add(1, std::memory_order_relaxed);
+			return op::yes;
+		}
+
+		op attempt_remove(const T& key, base_ptr node, int side, std::uint64_t node_v) {
+			while (1) {
+				base_ptr child = node->child[side].load();
+				if (node->version.load() != node_v) return op::retry;
+				if (!child) return op::no;
+				op res = op::retry;
+				int next = side_of(key, child);
+				if (next < 0) {
+					res = attempt_remove_node(node, child);
+				}
+				else {
+					std::uint64_t child_v = child->version.load();
+					if (child_v & shrinking) {
+						wait_until_not_changing(child);
+					}
+					else if (child_v != unlinked && child == node->child[side].load()) {
+						if (node->version.load() != node_v) return op::retry;
+						res = attempt_remove(key, child, next, child_v);
+					}
+				}
+				if (res != op::retry) return res;
+			}
+		}
+
+		static bool can_unlink(base_ptr n) noexcept {
+			return !n->child[0].load() || !n->child[1].load();
+		}
+
+		/*
+		 * With a child missing the node is spliced out under the locks of
+		 * its parent and itself. Otherwise it only turns into a routing
+		 * node, which needs its own lock alone.
+		 */
+		op attempt_remove_node(base_ptr par, base_ptr n) {
+			if (!n->present.load()) return op::no;
+			if (!can_unlink(n)) {
+				std::lock_guard<spin_lock> lock(n->lock);
+				if (n->version.load() == unlinked || can_unlink(n)) return op::retry;
+				if (!n->present.load()) return op::no;
+				n->present.store(false);
+				size_.fetch_sub(1, std::memory_order_relaxed);
+				return op::yes;
+			}
+			{
+				std::lock_guard<spin_lock> lock_par(par->lock);
+				if (par->version.load() == unlinked || n->parent.load() != par) return op::retry;
+				std::lock_guard<spin_lock> lock_n(n->lock);
+				if (!n->present.load()) return op::no;
+				if (!attempt_unlink_nl(par, n)) return op::retry;
+			}
+			size_.fetch_sub(1, std::memory_order_relaxed);
+			retire(n);
+			fix_height_and_rebalance(par);
+			return op::yes;
+		}
+
+		/* par and n are locked. */
+		static bool attempt_unlink_nl(base_ptr par, base_ptr n) {
+			int side = par->child[0].load() == n ? 0 : 1;
+			if (par->child[side].load() != n) return false;
+			base_ptr l = n->child[0].load(), r = n->child[1].load();
+			if (l && r) return false;
+			base_ptr splice = l ? l : r;
+			par->child[side].store(splice);
+			if (splice) {
+				splice->parent.store(par);
+			}
+			n->version.store(unlinked);
+			n->present.store(false);
+			return true;
+		}
+
+		void retire(base_ptr n) {
+			domain_.retire([n]() { delete static_cast<node_ptr>(n); });
+		}
+
+		static int node_condition(base_ptr n) noexcept {
+			base_ptr l = n->child[0].load(), r = n->child[1].load();
+			if ((!l || !r) && !n->present.load()) return unlink_required;
+			int h = n->height.load(), hl = get_height(l), hr = get_height(r);
+			int h_repl = 1 + (hl > hr ? hl : hr);
+			int bal = hl - hr;
+			if (bal < -1 || bal > 1) return rebalance_required;
+			return h != h_repl ? h_repl : nothing_required;
+		}
+
+		/*
+		 * Walk up from node repairing heights, balance and needless
+		 * routing nodes, until nothing changes any more. The holder has
+		 * no parent and ends the walk.
+		 *
+		 * A rotation may hand back a node it left below par, and the
+		 * height par sees has changed too. par is kept for later, once
+		 * the walk from below has settled.
+		 */
+		void fix_height_and_rebalance(base_ptr node) {
+			std::vector<base_ptr> later;
+			while (1) {
+				if (!node || !node->parent.load()) {
+					if (later.empty()) return;
+					node = later.back();
+					later.pop_back();
+					continue;
+				}
+				int c = node_condition(node);
+				if (c == nothing_required || node->version.load() == unlinked) {
+					node = nullptr;
+					continue;
+				}
+				if (c != unlink_required && c != rebalance_required) {
+					std::lock_guard<spin_lock> lock(node->lock);
+					node = fix_height_nl(node);
+					continue;
+				}
+				base_ptr par = node->parent.load();
+				base_ptr dead = nullptr;
+				{
+					std::lock_guard<spin_lock> lock_par(par->lock);
+					if (par->version.load() != unlinked && node->parent.load() == par) {
+						std::lock_guard<spin_lock> lock_n(node->lock);
+						base_ptr old = node;
+						node = rebalance_nl(par, node, dead);
+						if (node && node != par->parent.load() &&
+							par->child[0].load() != old && par->child[1].load() != old) {
+							later.push_back(par);
+						}
+					}
+				}
+				if (dead) {
+					retire(dead);
+				}
+			}
+		}
+
+		/* Return the next node to look at, or null when done. n is locked. */
+		static base_ptr fix_height_nl(base_ptr n) {
+			int c = node_condition(n);
+			switch (c) {
+			case rebalance_required:
+			case unlink_required:
+				return n;
+			case nothing_required:
+				return nullptr;
+			default:
+				n->height.store(c);
+				return n->parent.load();
+			}
+		}
+
+		/* par and n are locked. */
+		base_ptr rebalance_nl(base_ptr par, base_ptr n, base_ptr& dead) {
+			base_ptr l = n->child[0].load(), r = n->child[1].load();
+			if ((!l || !r) && !n->present.load()) {
+				if (attempt_unlink_nl(par, n)) {
+					dead = n;
+					return fix_height_nl(par);
+				}
+				return n;
+			}
+			int h = n->height.load(), hl = get_height(l), hr = get_height(r);
+			int h_repl = 1 + (hl > hr ? hl : hr);
+			int bal = hl - hr;
+			if (bal > 1) return rebalance_to_nl(par, n, 0, hr, dead);
+			if (bal < -1) return rebalance_to_nl(par, n, 1, hl, dead);
+			if (h_repl != h) {
+				n->height.store(h_repl);
+				return fix_height_nl(par);
+			}
+			return nullptr;
+		}
+
+		/*
+		 * n is too high on side s, h_o is the height of its other side.
+		 * par and n are locked. A single rotation when the outer
+		 * grandchild is at least as high as the inner one, a double one
+		 * when that leaves the middle balanced, else fix ns first.
+		 *
+		 * The paper also falls back to ns when the double rotation would
+		 * leave ns a routing node with one child. Nothing may be left to
+		 * do at ns then, and n would stay unbalanced, so here the double
+		 * rotation goes ahead and splices ns out itself.
+		 */
+		base_ptr rebalance_to_nl(base_ptr par, base_ptr n, int s, int h_o, base_ptr& dead) {
+			int o = 1 - s;
+			base_ptr ns = n->child[s].load();
+			std::unique_lock<spin_lock> lock_s(ns->lock);
+			int hs = ns->height.load();
+			if (hs - h_o <= 1) return n;
+			base_ptr nso = ns->child[o].load();
+			int hss0 = get_height(ns->child[s].load());
+			int hso0 = get_height(nso);
+			if (hss0 >= hso0) {
+				return rotate_nl(par, n, s, ns, h_o, hss0, nso, hso0);
+			}
+			{
+				std::lock_guard<spin_lock> lock_so(nso->lock);
+				int hso = nso->height.load();
+				if (hss0 >= hso) {
+					return rotate_nl(par, n, s, ns, h_o, hss0, nso, hso);
+				}
+				int hsos = get_height(nso->child[s].load());
+				int b = hss0 - hsos;
+				if (b >= -1 && b <= 1) {
+					return rotate_over_nl(par, n, s, ns, h_o, hss0, nso, hsos, dead);
+				}
+			}
+			/* Focus on ns, n is seen to later. */
+			return rebalance_to_nl(n, ns, o, hss0, dead);
+		}
+
+		static void replace_child(base_ptr par, base_ptr old_child, base_ptr new_child) {
+			if (par->child[0].load() == old_child) {
+				par->child[0].store(new_child);
+			}
+			else {
+				par->child[1].store(new_child);
+			}
+			new_child->parent.store(par);
+		}
+
+		static std::uint64_t begin_change(std::uint64_t v) noexcept {
+			return v | shrinking;
+		}
+
+		static std::uint64_t end_change(std::uint64_t v) noexcept {
+			return (v | shrinking) + shrinking;
+		}
+
+		/*
+		 * Single rotation, for s = 0 (to the right):
+		 *
+		 *        n               ns
+		 *       / \             /  \
+		 *     ns   o    =>    nss   n
+		 *    /  \                  / \
+		 *  nss  nso              nso  o
+		 *
+		 * Only n moves down, so only n is marked shrinking.
+		 */
+		base_ptr rotate_nl(base_ptr par, base_ptr n, int s, base_ptr ns, int h_o,
+			int hss, base_ptr nso, int hso) {
+			int o = 1 - s;
+			std::uint64_t n_v = n->version.load();
+			n->version.store(begin_change(n_v));
+
+			n->child[s].store(nso);
+			if (nso) {
+				nso->parent.store(n);
+			}
+			ns->child[o].store(n);
+			n->parent.store(ns);
+			replace_child(par, n, ns);
+
+			int hn_repl = 1 + (hso > h_o ? hso : h_o);
+			n->height.store(hn_repl);
+			ns->height.store(1 + (hss > hn_repl ? hss : hn_repl));
+			n->version.store(end_change(n_v));
+
+			int bal_n = hso - h_o;
+			if (bal_n < -1 || bal_n > 1) return n;
+			if ((!nso || h_o == 0) && !n->present.load()) return n;
+			int bal_s = hss - hn_repl;
+			if (bal_s < -1 || bal_s > 1) return ns;
+			if (hss == 0 && !ns->present.load()) return ns;
+			return fix_height_nl(par);
+		}
+
+		/*
+		 * Double rotation, for s = 0:
+		 *
+		 *          n                  nso
+		 *         / \               /     \
+		 *       ns   o    =>      ns       n
+		 *      /  \              /  \     / \
+		 *    nss  nso          nss nsos nsoo o
+		 *         /  \
+		 *      nsos  nsoo
+		 *
+		 * If ns is a routing node and nss or nsos is missing, ns is
+		 * unlinked right after, under the locks of nso and ns.
+		 */
+		base_ptr rotate_over_nl(base_ptr par, base_ptr n, int s, base_ptr ns, int h_o,
+			int hss, base_ptr nso, int hsos, base_ptr& dead) {
+			int o = 1 - s;
+			std::uint64_t n_v = n->version.load();
+			std::uint64_t s_v = ns->version.load();
+			base_ptr nsos = nso->child[s].load();
+			base_ptr nsoo = nso->child[o].load();
+			int hsoo = get_height(nsoo);
+
+			n->version.store(begin_change(n_v));
+			ns->version.store(begin_change(s_v));
+
+			n->child[s].store(nsoo);
+			if (nsoo) {
+				nsoo->parent.store(n);
+			}
+			ns->child[o].store(nsos);
+			if (nsos) {
+				nsos->parent.store(ns);
+			}
+			nso->child[s].store(ns);
+			ns->parent.store(nso);
+			nso->child[o].store(n);
+			n->parent.store(nso);
+			replace_child(par, n, nso);
+
+			int hn_repl = 1 + (hsoo > h_o ? hsoo : h_o);
+			n->height.store(hn_repl);
+			int hs_repl = 1 + (hss > hsos ? hss : hsos);
+			ns->height.store(hs_repl);
+
+			n->version.store(end_change(n_v));
+			ns->version.store(end_change(s_v));
+
+			if (!ns->present.load() && can_unlink(ns)) {
+				attempt_unlink_nl(nso, ns);
+				dead = ns;
+				hs_repl = hss > hsos ? hss : hsos;
+			}
+			nso->height.store(1 + (hs_repl > hn_repl ? hs_repl : hn_repl));
+
+			int bal_n = hsoo - h_o;
+			if (bal_n < -1 || bal_n > 1) return n;
+			if ((!nsoo || h_o == 0) && !n->present.load()) return n;
+			int bal_so = hs_repl - hn_repl;
+			if (bal_so < -1 || bal_so > 1) return nso;
+			return fix_height_nl(par);
+		}
+
+		static void destroy_subtree(base_ptr n) noexcept {
+			if (!n) return;
+			destroy_subtree(n->child[0].load());
+			destroy_subtree(n->child[1].load());
+			delete static_cast<node_ptr>(n);
+		}
+
+		/* Its right child is the root, it never moves or changes version. */
+		concurrent_node_base holder_;
+		std::atomic<size_type> size_;
+		Compare comp_;
+		mutable epoch_domain domain_;
+	};
+}
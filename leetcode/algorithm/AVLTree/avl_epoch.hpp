@@ -0,0 +1,171 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+namespace avl {
+
+	/*
+	 * Epoch based reclamation. A reader pins the domain before it
+	 * touches shared nodes and unpins when it's done, a writer that has
+	 * unlinked nodes retires them with a closure that frees them. The
+	 * closure runs once every reader pinned at the time of retirement
+	 * has unpinned:
+	 *
+	 *   global: 7 ............. 8 ............. 9
+	 *   writer:   unlink A, retire(A) tagged 7
+	 *   reader:  pin(7) ---------------- unpin
+	 *   reader:               pin(8) ----------------
+	 *                                       ^ A may go, no pin <= 7
+	 *
+	 * Retiring advances the global epoch, so a reader pinned later
+	 * can't have seen A. Reader slots are claimed with one exchange
+	 * and released with one store, so pinning never blocks. Slots are
+	 * kept in a list that only grows, up to the largest number of
+	 * readers ever pinned at once.
+	 */
+	class epoch_domain {
+		struct alignas(64) slot {
+			std::atomic<std::uint64_t> epoch{ 0 };  /* 0 means not pinned */
+			std::atomic<bool> used{ false };
+			slot* next = nullptr;
+		};
+
+	public:
+		/* Keeps the domain pinned while it lives. */
+		class guard {
+		public:
+			guard() noexcept :
+				slot_(nullptr) {}
+
+			guard(guard&& rhs) noexcept :
+				slot_(rhs.slot_) {
+				rhs.slot_ = nullptr;
+			}
+
+			guard& operator=(guard&& rhs) noexcept {
+				if (this != &rhs) {
+					unpin();
+					slot_ = rhs.slot_;
+					rhs.slot_ = nullptr;
+				}
+				return *this;
+			}
+
+			guard(const guard&) = delete;
+			guard& operator=(const guard&) = delete;
+
+			~guard() noexcept {
+				unpin();
+			}
+
+			void unpin() noexcept {
+				if (slot_) {
+					slot_->epoch.store(0, std::memory_order_release);
+					slot_->used.store(false, std::memory_order_release);
+					slot_ = nullptr;
+				}
+			}
+
+		private:
+			friend class epoch_domain;
+
+			explicit guard(slot* s) noexcept :
+				slot_(s) {}
+
+			slot* slot_;
+		};
+
+		epoch_domain() = default;
+
+		epoch_domain(const epoch_domain&) = delete;
+		epoch_domain& operator=(const epoch_domain&) = delete;
+
+		/* Every guard must be gone by now. */
+		~epoch_domain() noexcept {
+			for (auto& r : retired_) {
+				r.second();
+			}
+			for (auto s = head_.load(); s; ) {
+				auto temp = s->next;
+				delete s;
+				s = temp;
+			}
+		}
+
+		/*
+		 * The announcement is sequentially consistent with the loads of
+		 * shared pointers after it and with the scan in collect(). So
+		 * either the scan sees it, or the reader sees what the writer
+		 * published before scanning.
+		 */
+		guard pin() {
+			slot* s = acquire_slot();
+			s->epoch.store(global_.load());
+			return guard(s);
+		}
+
+		/* Run reclaim once no reader can still see what it frees. */
+		void retire(std::function<void()> reclaim) {
+			std::uint64_t tag = global_.fetch_add(1);
+			std::lock_guard<std::mutex> lock(mutex_);
+			retired_.emplace_back(tag, std::move(reclaim));
+			collect_locked();
+		}
+
+		/* Run what can be run now. */
+		void collect() {
+			std::lock_guard<std::mutex> lock(mutex_);
+			collect_locked();
+		}
+
+		std::size_t pending() const {
+			std::lock_guard<std::mutex> lock(mutex_);
+			return retired_.size();
+		}
+
+	private:
+		slot* acquire_slot() {
+			for (auto s = head_.load(std::memory_order_acquire); s; s = s->next) {
+				if (!s->used.load(std::memory_order_relaxed) &&
+					!s->used.exchange(true, std::memory_order_acquire)) {
+					return s;
+				}
+			}
+			slot* s = new slot;
+			s->used.store(true, std::memory_order_relaxed);
+			s->next = head_.load(std::memory_order_relaxed);
+			while (!head_.compare_exchange_weak(s->next, s,
+				std::memory_order_release, std::memory_order_relaxed)) {}
+			return s;
+		}
+
+		/*
+		 * Run the retired closures older than every pin, from the front.
+		 * Two writers may queue their tags out of order, then the later
+		 * one just waits for the next collection.
+		 */
+		void collect_locked() {
+			std::uint64_t oldest = UINT64_MAX;
+			for (auto s = head_.load(std::memory_order_acquire); s; s = s->next) {
+				std::uint64_t e = s->epoch.load();
+				if (e && e < oldest) {
+					oldest = e;
+				}
+			}
+			while (!retired_.empty() && retired_.front().first < oldest) {
+				auto fn = std::move(retired_.front().second);
+				retired_.pop_front();
+				fn();
+			}
+		}
+
+		std::atomic<std::uint64_t> global_{ 1 };
+		std::atomic<slot*> head_{ nullptr };
+		mutable std::mutex mutex_;
+		std::deque<std::pair<std::uint64_t, std::function<void()>>> retired_;
+	};
+}
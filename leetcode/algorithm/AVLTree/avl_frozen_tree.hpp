@@ -0,0 +1,275 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+#if __has_include(<bit>)
+#include <bit>
+#endif
+
+namespace avl {
+
+	/* Blocks of a frozen tree start on a cache line. */
+	template<typename T>
+	struct cache_aligned_allocator {
+		using value_type = T;
+		static constexpr std::size_t alignment = alignof(T) > 64 ? alignof(T) : 64;
+
+		cache_aligned_allocator() = default;
+
+		template<typename U>
+		cache_aligned_allocator(const cache_aligned_allocator<U>&) noexcept {}
+
+		T* allocate(std::size_t n) {
+			return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+		}
+
+		void deallocate(T* p, std::size_t) noexcept {
+			::operator delete(p, std::align_val_t(alignment));
+		}
+
+		template<typename U>
+		bool operator==(const cache_aligned_allocator<U>&) const noexcept { return true; }
+
+		template<typename U>
+		bool operator!=(const cache_aligned_allocator<U>&) const noexcept { return false; }
+	};
+
+	/*
+	 * A read-only snapshot of a sorted set in Eytzinger order, that is
+	 * the nodes of a complete binary tree stored level by level with
+	 * the children of slot k at 2k and 2k + 1. Slot 0 is unused:
+	 *
+	 *            4                 slot:  1 2 3 4 5 6 7
+	 *          /   \               key:   4 2 6 1 3 5 7
+	 *         2     6
+	 *        / \   / \
+	 *       1   3 5   7
+	 *
+	 * There are no links at all. A search is 'k = 2k + (a[k] < key)'
+	 * per level, which compiles to a conditional move instead of a
+	 * branch, and the top levels share a few cache lines that stay hot.
+	 * The 2^d descendants d levels below slot k sit side by side from
+	 * slot k * 2^d, so one prefetch per level brings in the line the
+	 * search will need d steps later.
+	 *
+	 * Build it with tree::freeze(), or from any sorted unique range.
+	 */
+	template<typename T, typename Compare = std::less<T>>
+	class frozen_tree {
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using const_pointer = const T*;
+
+		frozen_tree() :
+			size_(0) {}
+
+		/* [first, last) must be sorted and unique under comp. */
+		template<typename ForwardIt>
+		frozen_tree(ForwardIt first, ForwardIt last, const Compare& comp = Compare()) :
+			size_(0),
+			comp_(comp) {
+			std::vector<const T*> src;
+			for (; first != last; ++first) {
+				src.push_back(std::addressof(*first));
+			}
+			build(src);
+		}
+
+		size_type size() const noexcept {
+			return size_;
+		}
+
+		bool empty() const noexcept {
+			return size_ == 0;
+		}
+
+		key_compare key_comp() const { return comp_; }
+
+		/* The first element not less than key, or null. */
+		template<typename K>
+		const_pointer lower_bound(const K& key) const {
+			size_type k = lower_bound_native(key);
+			return k ? &slots_[k] : nullptr;
+		}
+
+		/* The element equal to key, or null. */
+		template<typename K>
+		const_pointer find(const K& key) const {
+			size_type k = lower_bound_native(key);
+			return k && !comp_(key, slots_[k]) ? &slots_[k] : nullptr;
+		}
+
+		template<typename K>
+		bool contains(const K& key) const {
+			return find(key) != nullptr;
+		}
+
+		/*
+		 * Batched lookups. Keys are searched a group at a time, level by
+		 * level, so the cache misses of one group overlap instead of
+		 * being paid one after another. One pointer per key goes to out,
+		 * null where lower_bound() or find() would return null.
+		 */
+		template<typename InputIt, typename OutputIt>
+		OutputIt lower_bound(InputIt first, InputIt last, OutputIt out) const {
+			return batch(first, last, out, [this](const auto&, size_type k) -> const_pointer {
+				return k ? &slots_[k] : nullptr;
+			});
+		}
+
+		template<typename InputIt, typename OutputIt>
+		OutputIt find(InputIt first, InputIt last, OutputIt out) const {
+			return batch(first, last, out, [this](const auto& key, size_type k) -> const_pointer {
+				return k && !comp_(key, slots_[k]) ? &slots_[k] : nullptr;
+			});
+		}
+
+	private:
+		using alloc_type = cache_aligned_allocator<T>;
+
+		/*
+		 * Slots prefetched ahead: as many as fill a cache line, so their
+		 * descendants that far below are a single line.
+		 */
+		static constexpr size_type prefetch_slots = sizeof(T) >= 64 ? 1 :
+			(sizeof(T) > 32 ? 2 : (sizeof(T) > 16 ? 4 : (sizeof(T) > 8 ? 8 : 16)));
+
+		/*
+		 * Walk the implicit tree in order and take the sorted elements
+		 * one by one, which puts each one in its Eytzinger slot.
+		 */
+		void build(const std::vector<const T*>& src) {
+			size_type n = src.size();
+			if (!n) return;
+			std::vector<size_type> order(n + 1);
+			size_type i = 0;
+			size_type k = 1;
+			/* Iterative in-order walk: down left, visit, then right. */
+			while (1) {
+				while (k <= n) {
+					k <<= 1;
+				}
+				k >>= trailing_ones(k) + 1;
+				if (!k) break;
+				order[k] = i++;
+				k = 2 * k + 1;
+			}
+			slots_.reserve(n + 1);
+			slots_.push_back(*src[0]);
+			for (k = 1; k <= n; k++) {
+				slots_.push_back(*src[order[k]]);
+			}
+			size_ = n;
+			levels_ = 0;
+			for (size_type m = n; m; m >>= 1) {
+				levels_++;
+			}
+		}
+
+		/*
+		 * Every level but the last is full, so the first levels_ - 1
+		 * steps need no bound check. The path ends below the answer:
+		 * the answer is the last slot where the search went left, and
+		 * each step right after it appended a 1 bit to k. Strip those
+		 * ones and the left step before them. All ones means the search
+		 * never went left, nothing is at least key, and k becomes 0.
+		 */
+		template<typename K>
+		size_type lower_bound_native(const K& key) const {
+			if (!size_) return 0;
+			const T* a = slots_.data();
+			size_type k = 1;
+			for (int l = 1; l < levels_; l++) {
+				prefetch(a, k * prefetch_slots);
+				k = 2 * k + comp_(a[k], key);
+			}
+			if (k <= size_) {
+				k = 2 * k + comp_(a[k], key);
+			}
+			return k >> (trailing_ones(k) + 1);
+		}
+
+		template<typename InputIt, typename OutputIt, typename Result>
+		OutputIt batch(InputIt first, InputIt last, OutputIt out, Result result) const {
+			constexpr int group = 16;
+			using key_type = typename std::iterator_traits<InputIt>::value_type;
+			const T* a = slots_.data();
+			std::vector<key_type> keys;
+			keys.reserve(group);
+			size_type k[group];
+			while (first != last) {
+				keys.clear();
+				for (; first != last && keys.size() < group; ++first) {
+					keys.push_back(*first);
+				}
+				int cnt = static_cast<int>(keys.size());
+				if (!size_) {
+					for (int j = 0; j < cnt; j++) {
+						*out++ = result(keys[j], 0);
+					}
+					continue;
+				}
+				for (int j = 0; j < cnt; j++) {
+					k[j] = 1;
+				}
+				for (int l = 1; l < levels_; l++) {
+					for (int j = 0; j < cnt; j++) {
+						prefetch(a, k[j] * prefetch_slots);
+						k[j] = 2 * k[j] + comp_(a[k[j]], keys[j]);
+					}
+				}
+				for (int j = 0; j < cnt; j++) {
+					if (k[j] <= size_) {
+						k[j] = 2 * k[j] + comp_(a[k[j]], keys[j]);
+					}
+					*out++ = result(keys[j], k[j] >> (trailing_ones(k[j]) + 1));
+				}
+			}
+			return out;
+		}
+
+		/* A hint only, it never faults, so slots past the end are fine. */
+		static void prefetch(const T* a, size_type slot) noexcept {
+			auto addr = reinterpret_cast<const char*>(
+				reinterpret_cast<std::uintptr_t>(a) + slot * sizeof(T));
+#if defined(__GNUC__) || defined(__clang__)
+			__builtin_prefetch(addr);
+#elif defined(_MSC_VER)
+			_mm_prefetch(addr, _MM_HINT_T0);
+#else
+			(void)addr;
+#endif
+		}
+
+		static int trailing_ones(size_type k) noexcept {
+#if defined(__cpp_lib_bitops)
+			return std::countr_one(k);
+#elif defined(__GNUC__) || defined(__clang__)
+			return ~k ? __builtin_ctzll(~static_cast<unsigned long long>(k)) :
+				static_cast<int>(sizeof(k) * 8);
+#else
+			int res = 0;
+			while (k & 1) {
+				k >>= 1;
+				res++;
+			}
+			return res;
+#endif
+		}
+
+		std::vector<T, alloc_type> slots_;
+		size_type size_;
+		int levels_ = 0;  /* depth of the implicit tree */
+		Compare comp_;
+	};
+}
@@ -0,0 +1,590 @@
+#pragma once
+#include <tuple>
+#include <utility>
+#include "avl_tree_plus.hpp"
+
+namespace avl {
+
+	/*
+	 * A mapped value kept out of line. The node only holds the key and
+	 * one pointer, so a descent over large payloads touches the cache
+	 * lines of keys and links and nothing else:
+	 *
+	 *   node: [height|size|left|right|parent|key|*]
+	 *                                            |
+	 *                                            +--> [ payload ... ]
+	 *
+	 * map<K, boxed<V>> hands out V& from operator[], at() and friends,
+	 * the box itself only shows through the iterators. The payload is
+	 * taken from the heap, not from the allocator of the map.
+	 */
+	template<typename V>
+	class boxed {
+	public:
+		boxed() :
+			ptr_(new V()) {}
+
+		template<typename ...Args>
+		explicit boxed(std::in_place_t, Args&&... args) :
+			ptr_(new V(std::forward<Args>(args)...)) {}
+
+		boxed(const boxed& rhs) :
+			ptr_(rhs.ptr_ ? new V(*rhs.ptr_) : nullptr) {}
+
+		boxed(boxed&& rhs) noexcept :
+			ptr_(rhs.ptr_) {
+			rhs.ptr_ = nullptr;
+		}
+
+		boxed& operator=(const boxed& rhs) {
+			if (this != &rhs) {
+				boxed temp(rhs);
+				std::swap(ptr_, temp.ptr_);
+			}
+			return *this;
+		}
+
+		boxed& operator=(boxed&& rhs) noexcept {
+			std::swap(ptr_, rhs.ptr_);
+			return *this;
+		}
+
+		~boxed() noexcept {
+			delete ptr_;
+		}
+
+		V& operator*() noexcept { return *ptr_; }
+
+		const V& operator*() const noexcept { return *ptr_; }
+
+		V* operator->() noexcept { return ptr_; }
+
+		const V* operator->() const noexcept { return ptr_; }
+
+		V* get() noexcept { return ptr_; }
+
+		const V* get() const noexcept { return ptr_; }
+
+	private:
+		V* ptr_;
+	};
+
+	/*
+	 * How a map builds and reaches its mapped value. Plain values are
+	 * built from the arguments, boxed ones get them through the box.
+	 */
+	template<typename V>
+	struct mapped_traits {
+		using type = V;
+
+		static V& get(V& v) noexcept { return v; }
+
+		static const V& get(const V& v) noexcept { return v; }
+
+		template<typename ...Args>
+		static std::tuple<Args&&...> args(Args&&... args) {
+			return std::forward_as_tuple(std::forward<Args>(args)...);
+		}
+	};
+
+	template<typename V>
+	struct mapped_traits<boxed<V>> {
+		using type = V;
+
+		static V& get(boxed<V>& v) noexcept { return *v; }
+
+		static const V& get(const boxed<V>& v) noexcept { return *v; }
+
+		template<typename ...Args>
+		static std::tuple<const std::in_place_t&, Args&&...> args(Args&&... args) {
+			return std::forward_as_tuple(std::in_place, std::forward<Args>(args)...);
+		}
+	};
+
+	/*
+	 * Order pairs by their keys. It's transparent, so the tree under a
+	 * map looks a key up without building a pair around it. Anything
+	 * but a pair is handed to Compare as it is.
+	 */
+	template<typename K, typename V, typename Compare>
+	struct map_compare {
+		using is_transparent = void;
+		using value_type = std::pair<const K, V>;
+
+		map_compare() = default;
+
+		explicit map_compare(const Compare& c) :
+			comp(c) {}
+
+		template<typename A, typename B>
+		bool operator()(const A& a, const B& b) const {
+			return comp(key_of(a), key_of(b));
+		}
+
+		static const K& key_of(const value_type& v) noexcept { return v.first; }
+
+		template<typename U>
+		static const U& key_of(const U& u) noexcept { return u; }
+
+		Compare comp;
+	};
+
+	/*
+	 * Unique keys mapped to values, on the same nodes, descents and
+	 * rotations as tree. Every lookup is one descent with one key
+	 * comparison per level, try_emplace() and operator[] hang the new
+	 * node where that descent ended instead of searching again.
+	 */
+	template<typename K, typename V, typename Compare = std::less<K>,
+		typename Allocator = std::allocator<std::pair<const K, V>>>
+	class map : private tree<std::pair<const K, V>, map_compare<K, V, Compare>, Allocator> {
+		using base = tree<std::pair<const K, V>, map_compare<K, V, Compare>, Allocator>;
+		using traits = mapped_traits<V>;
+		using base_ptr = typename base::base_ptr;
+
+	public:
+		using key_type = K;
+		using mapped_type = typename traits::type;
+		using value_type = std::pair<const K, V>;
+		using key_compare = Compare;
+		using value_compare = map_compare<K, V, Compare>;
+		using allocator_type = typename base::allocator_type;
+		using reference = typename base::reference;
+		using const_reference = typename base::const_reference;
+		using size_type = typename base::size_type;
+		using difference_type = typename base::difference_type;
+		using iterator = typename base::iterator;
+		using const_iterator = typename base::const_iterator;
+		using reverse_iterator = typename base::reverse_iterator;
+		using const_reverse_iterator = typename base::const_reverse_iterator;
+		using node_type = typename base::node_type;
+		using insert_return_type = typename base::insert_return_type;
+
+		map() = default;
+
+		explicit map(const Compare& comp, const Allocator& alloc = Allocator()) :
+			base(value_compare(comp), alloc) {}
+
+		explicit map(const Allocator& alloc) :
+			base(alloc) {}
+
+		/* Sorted input takes O(1) comparisons per element. */
+		template<typename InputIt>
+		map(InputIt first, InputIt last, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			base(value_compare(comp), alloc) {
+			for (; first != last; ++first) {
+				emplace_hint(end(), *first);
+			}
+		}
+
+		map(std::initializer_list<value_type> il, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			map(il.begin(), il.end(), comp, alloc) {}
+
+		using base::get_allocator;
+		using base::begin;
+		using base::cbegin;
+		using base::end;
+		using base::cend;
+		using base::front;
+		using base::back;
+		using base::empty;
+		using base::size;
+		using base::clear;
+		using base::insert;
+		using base::emplace;
+		using base::emplace_hint;
+		using base::erase;
+		using base::extract;
+		using base::parallel_for_each;
+		using base::parallel_reduce;
+		using base::parallel_count_if;
+
+		key_compare key_comp() const { return this->comp_.comp; }
+
+		value_compare value_comp() const { return this->comp_; }
+
+		void swap(map& rhs) noexcept {
+			base::swap(rhs);
+		}
+
+		/* Splice over the nodes whose keys aren't here, see tree::merge(). */
+		void merge(map& src) {
+			base::merge(src);
+		}
+
+		void merge(map&& src) {
+			base::merge(src);
+		}
+
+		template<typename ...Args>
+		std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+			auto res = try_emplace_native(nullptr, key, std::forward<Args>(args)...);
+			return { iterator(res.first), res.second };
+		}
+
+		template<typename ...Args>
+		std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args) {
+			auto res = try_emplace_native(nullptr, std::move(key), std::forward<Args>(args)...);
+			return { iterator(res.first), res.second };
+		}
+
+		/* The search starts at hint, like tree::emplace_hint(). */
+		template<typename ...Args>
+		iterator try_emplace(const_iterator hint, const key_type& key, Args&&... args) {
+			return iterator(try_emplace_native(start_of(hint), key,
+				std::forward<Args>(args)...).first);
+		}
+
+		template<typename ...Args>
+		iterator try_emplace(const_iterator hint, key_type&& key, Args&&... args) {
+			return iterator(try_emplace_native(start_of(hint), std::move(key),
+				std::forward<Args>(args)...).first);
+		}
+
+		template<typename M>
+		std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj) {
+			return insert_or_assign_native(key, std::forward<M>(obj));
+		}
+
+		template<typename M>
+		std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj) {
+			return insert_or_assign_native(std::move(key), std::forward<M>(obj));
+		}
+
+		mapped_type& operator[](const key_type& key) {
+			return value_of(try_emplace_native(nullptr, key).first);
+		}
+
+		mapped_type& operator[](key_type&& key) {
+			return value_of(try_emplace_native(nullptr, std::move(key)).first);
+		}
+
+		mapped_type& at(const key_type& key) {
+			return value_of(at_native(key));
+		}
+
+		const mapped_type& at(const key_type& key) const {
+			return value_of(at_native(key));
+		}
+
+		size_type erase(const key_type& key) {
+			auto node = this->find_native(key);
+			if (!node) {
+				return 0;
+			}
+			this->erase_native(node);
+			return 1;
+		}
+
+		iterator find(const key_type& key) {
+			return iterator(this->find_native(key));
+		}
+
+		const_iterator find(const key_type& key) const {
+			return const_iterator(this->find_native(key));
+		}
+
+		template<typename Q, typename C = Compare, typename = typename C::is_transparent>
+		iterator find(const Q& key) {
+			return iterator(this->find_native(key));
+		}
+
+		template<typename Q, typename C = Compare, typename = typename C::is_transparent>
+		const_iterator find(const Q& key) const {
+			return const_iterator(this->find_native(key));
+		}
+
+		bool contains(const key_type& key) const {
+			return this->find_native(key) != nullptr;
+		}
+
+		template<typename Q, typename C = Compare, typename = typename C::is_transparent>
+		bool contains(const Q& key) const {
+			return this->find_native(key) != nullptr;
+		}
+
+		size_type count(const key_type& key) const {
+			return contains(key) ? 1 : 0;
+		}
+
+		iterator lower_bound(const key_type& key) {
+			return iterator(this->lower_bound_native(key));
+		}
+
+		const_iterator lower_bound(const key_type& key) const {
+			return const_iterator(this->lower_bound_native(key));
+		}
+
+		iterator upper_bound(const key_type& key) {
+			return iterator(this->upper_bound_native(key));
+		}
+
+		const_iterator upper_bound(const key_type& key) const {
+			return const_iterator(this->upper_bound_native(key));
+		}
+
+		std::pair<iterator, iterator> equal_range(const key_type& key) {
+			auto res = this->equal_range_native(key);
+			return { iterator(res.first), iterator(res.second) };
+		}
+
+		std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const {
+			auto res = this->equal_range_native(key);
+			return { const_iterator(res.first), const_iterator(res.second) };
+		}
+
+		/* Keys in [lo, hi), counted from the subtree sizes. */
+		size_type count_range(const key_type& lo, const key_type& hi) const {
+			return this->count_range_native(lo, hi);
+		}
+
+		/* Number of keys less than key. */
+		size_type rank(const key_type& key) const {
+			return this->rank_native(key);
+		}
+
+	private:
+		base_ptr start_of(const_iterator hint) const {
+			return hint.node_ ? hint.node_ : this->rightmost(this->root_);
+		}
+
+		/*
+		 * One descent, from the root or as a finger search from start.
+		 * The arguments are only used when the key is missing, so they
+		 * may be moved from in that case alone.
+		 */
+		template<typename KK, typename ...Args>
+		std::pair<base_ptr, bool> try_emplace_native(base_ptr start, KK&& key, Args&&... args) {
+			base_ptr parent;
+			bool left;
+			base_ptr found = start ? this->finger_locate(start, key, parent, left)
+				: this->locate(this->root_, key, parent, left);
+			if (found) {
+				return { found, false };
+			}
+			base_ptr node = this->create_node(std::piecewise_construct,
+				std::forward_as_tuple(std::forward<KK>(key)),
+				traits::args(std::forward<Args>(args)...));
+			this->link_leaf(node, parent, left);
+			return { node, true };
+		}
+
+		template<typename KK, typename M>
+		std::pair<iterator, bool> insert_or_assign_native(KK&& key, M&& obj) {
+			auto res = try_emplace_native(nullptr, std::forward<KK>(key), std::forward<M>(obj));
+			if (!res.second) {
+				value_of(res.first) = std::forward<M>(obj);
+			}
+			return { iterator(res.first), res.second };
+		}
+
+		base_ptr at_native(const key_type& key) const {
+			auto node = this->find_native(key);
+			if (!node) {
+				throw std::out_of_range("key is out of map");
+			}
+			return node;
+		}
+
+		static mapped_type& value_of(base_ptr node) noexcept {
+			return traits::get(node->as_node()->data.second);
+		}
+	};
+
+	/*
+	 * Keys may repeat. Equal keys stay in insertion order, a new one
+	 * always goes right of its equals, so the descent needs a single
+	 * 'key < data' per level and no equality test at all.
+	 */
+	template<typename K, typename V, typename Compare = std::less<K>,
+		typename Allocator = std::allocator<std::pair<const K, V>>>
+	class multimap : private tree<std::pair<const K, V>, map_compare<K, V, Compare>, Allocator> {
+		using base = tree<std::pair<const K, V>, map_compare<K, V, Compare>, Allocator>;
+		using traits = mapped_traits<V>;
+		using base_ptr = typename base::base_ptr;
+
+	public:
+		using key_type = K;
+		using mapped_type = typename traits::type;
+		using value_type = std::pair<const K, V>;
+		using key_compare = Compare;
+		using value_compare = map_compare<K, V, Compare>;
+		using allocator_type = typename base::allocator_type;
+		using reference = typename base::reference;
+		using const_reference = typename base::const_reference;
+		using size_type = typename base::size_type;
+		using difference_type = typename base::difference_type;
+		using iterator = typename base::iterator;
+		using const_iterator = typename base::const_iterator;
+		using reverse_iterator = typename base::reverse_iterator;
+		using const_reverse_iterator = typename base::const_reverse_iterator;
+
+		multimap() = default;
+
+		explicit multimap(const Compare& comp, const Allocator& alloc = Allocator()) :
+			base(value_compare(comp), alloc) {}
+
+		explicit multimap(const Allocator& alloc) :
+			base(alloc) {}
+
+		template<typename InputIt>
+		multimap(InputIt first, InputIt last, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			base(value_compare(comp), alloc) {
+			for (; first != last; ++first) {
+				emplace(*first);
+			}
+		}
+
+		multimap(std::initializer_list<value_type> il, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			multimap(il.begin(), il.end(), comp, alloc) {}
+
+		using base::get_allocator;
+		using base::begin;
+		using base::cbegin;
+		using base::end;
+		using base::cend;
+		using base::front;
+		using base::back;
+		using base::empty;
+		using base::size;
+		using base::clear;
+		using base::erase;
+		using base::parallel_for_each;
+		using base::parallel_reduce;
+		using base::parallel_count_if;
+
+		key_compare key_comp() const { return this->comp_.comp; }
+
+		value_compare value_comp() const { return this->comp_; }
+
+		void swap(multimap& rhs) noexcept {
+			base::swap(rhs);
+		}
+
+		iterator insert(const value_type& v) {
+			return emplace(v);
+		}
+
+		iterator insert(value_type&& v) {
+			return emplace(std::move(v));
+		}
+
+		template<typename ...Args>
+		iterator emplace(Args&&... args) {
+			base_ptr node = this->create_node(std::forward<Args>(args)...);
+			base_ptr parent = nullptr;
+			bool left = false;
+			try {
+				for (auto temp = this->root_; temp; ) {
+					parent = temp;
+					left = this->comp_(node->as_node()->data, temp->as_node()->data);
+					temp = left ? temp->left : temp->right;
+				}
+			}
+			catch (...) {
+				this->destroy_node(node);
+				throw;
+			}
+			this->link_leaf(node, parent, left);
+			return iterator(node);
+		}
+
+		/* Erase every element with key, return how many there were. */
+		size_type erase(const key_type& key) {
+			size_type res = 0;
+			iterator it(this->lower_bound_native(key));
+			while (it != end() && !this->comp_(key, *it)) {
+				it = erase(it);
+				res++;
+			}
+			return res;
+		}
+
+		/* The first element with key. */
+		iterator find(const key_type& key) {
+			return iterator(find_first(key));
+		}
+
+		const_iterator find(const key_type& key) const {
+			return const_iterator(find_first(key));
+		}
+
+		bool contains(const key_type& key) const {
+			return find_first(key) != nullptr;
+		}
+
+		/* Two descents, however many equal keys there are. */
+		size_type count(const key_type& key) const {
+			return rank_upper(key) - this->rank_native(key);
+		}
+
+		iterator lower_bound(const key_type& key) {
+			return iterator(this->lower_bound_native(key));
+		}
+
+		const_iterator lower_bound(const key_type& key) const {
+			return const_iterator(this->lower_bound_native(key));
+		}
+
+		iterator upper_bound(const key_type& key) {
+			return iterator(this->upper_bound_native(key));
+		}
+
+		const_iterator upper_bound(const key_type& key) const {
+			return const_iterator(this->upper_bound_native(key));
+		}
+
+		std::pair<iterator, iterator> equal_range(const key_type& key) {
+			return { lower_bound(key), upper_bound(key) };
+		}
+
+		std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const {
+			return { lower_bound(key), upper_bound(key) };
+		}
+
+		/* Elements with keys in [lo, hi), counted from the subtree sizes. */
+		size_type count_range(const key_type& lo, const key_type& hi) const {
+			return this->count_range_native(lo, hi);
+		}
+
+		size_type rank(const key_type& key) const {
+			return this->rank_native(key);
+		}
+
+	private:
+		base_ptr find_first(const key_type& key) const {
+			base_ptr node = this->lower_bound_native(key);
+			return node && !this->comp_(key, node->as_node()->data) ? node : nullptr;
+		}
+
+		/* Number of elements not greater than key. */
+		size_type rank_upper(const key_type& key) const {
+			size_type res = 0;
+			auto node = this->root_;
+			while (node) {
+				if (this->comp_(key, node->as_node()->data)) {
+					node = node->left;
+				}
+				else {
+					res += 1 + (node->left ? node->left->size : 0);
+					node = node->right;
+				}
+			}
+			return res;
+		}
+	};
+
+	template<typename K, typename V, typename C, typename A>
+	void swap(map<K, V, C, A>& lhs, map<K, V, C, A>& rhs) noexcept {
+		lhs.swap(rhs);
+	}
+
+	template<typename K, typename V, typename C, typename A>
+	void swap(multimap<K, V, C, A>& lhs, multimap<K, V, C, A>& rhs) noexcept {
+		lhs.swap(rhs);
+	}
+}
@@ -0,0 +1,461 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "avl_tree_plus.hpp"
+
+namespace avl {
+
+	/*
+	 * A tree image is a balanced tree written out with its links as
+	 * node numbers instead of pointers, so it means the same wherever
+	 * it sits in memory and can be searched straight from a read-only
+	 * mapping of the file:
+	 *
+	 *   0        64                stride
+	 *   | header | node 0 | node 1 | node 2 | ...
+	 *              |
+	 *              +-- | T | left | right | parent |   (uint32 numbers,
+	 *                                                  0xffffffff is none)
+	 *
+	 * Nodes are stored level by level from the root, so the first
+	 * levels, which every search goes through, share the first pages of
+	 * the file. A search faults in only the pages on its path, and
+	 * processes mapping the same file share the same physical pages.
+	 * Integers are in the byte order of the machine that wrote them.
+	 */
+	struct image_header {
+		char magic[4];
+		std::uint32_t version;
+		std::uint32_t value_size;
+		std::uint32_t stride;      /* bytes per node */
+		std::uint64_t count;
+		std::uint32_t root;
+		std::uint32_t link_offset; /* where left/right/parent start in a node */
+		unsigned char reserved[32];
+	};
+
+	static_assert(sizeof(image_header) == 64, "the nodes of an image start at byte 64");
+
+	template<typename T>
+	struct image_layout {
+		static constexpr std::uint32_t version = 1;
+		static constexpr std::uint32_t nil = 0xffffffffu;
+		static constexpr std::size_t align = alignof(T) > 4 ? alignof(T) : 4;
+		static constexpr std::size_t link_offset = (sizeof(T) + 3) / 4 * 4;
+		static constexpr std::size_t stride = (link_offset + 12 + align - 1) / align * align;
+
+		static_assert(alignof(T) <= 64, "an image aligns nodes to at most 64 bytes");
+	};
+
+	/*
+	 * Write t as an image. The shape is the one build_sorted() gives,
+	 * numbered in level order: the range of a node is split in the
+	 * middle, and its children are numbered when it is written.
+	 */
+	template<typename T, typename Compare, typename Allocator>
+	void write_image(std::ostream& os, const tree<T, Compare, Allocator>& t) {
+		static_assert(std::is_trivially_copyable<T>::value, "an image needs a trivially copyable T");
+		using layout = image_layout<T>;
+		if (t.size() >= layout::nil) {
+			throw std::length_error("too many elements for a tree image");
+		}
+		std::vector<const T*> src;
+		src.reserve(t.size());
+		for (auto it = t.begin(); it != t.end(); ++it) {
+			src.push_back(std::addressof(*it));
+		}
+
+		image_header h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, "AVLI", 4);
+		h.version = layout::version;
+		h.value_size = sizeof(T);
+		h.stride = layout::stride;
+		h.count = src.size();
+		h.root = src.empty() ? layout::nil : 0;
+		h.link_offset = layout::link_offset;
+		os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+		/* A pending node: its slice of src and its parent's number. */
+		struct range {
+			std::size_t first;
+			std::size_t count;
+			std::uint32_t parent;
+		};
+		std::deque<range> queue;
+		if (!src.empty()) {
+			queue.push_back({ 0, src.size(), layout::nil });
+		}
+		std::uint32_t next = 1;
+		std::vector<unsigned char> node(layout::stride);
+		while (!queue.empty()) {
+			range r = queue.front();
+			queue.pop_front();
+			std::size_t left_count = r.count / 2;
+			std::size_t right_count = r.count - left_count - 1;
+			std::uint32_t links[3] = { layout::nil, layout::nil, r.parent };
+			std::uint32_t self = next - 1 - static_cast<std::uint32_t>(queue.size());
+			if (left_count) {
+				links[0] = next++;
+				queue.push_back({ r.first, left_count, self });
+			}
+			if (right_count) {
+				links[1] = next++;
+				queue.push_back({ r.first + left_count + 1, right_count, self });
+			}
+			std::memset(node.data(), 0, node.size());
+			std::memcpy(node.data(), src[r.first + left_count], sizeof(T));
+			std::memcpy(node.data() + layout::link_offset, links, sizeof(links));
+			os.write(reinterpret_cast<const char*>(node.data()), node.size());
+		}
+		if (!os) {
+			throw std::runtime_error("tree image write failed");
+		}
+	}
+
+	/*
+	 * A read-only tree over an image somewhere in memory. Nothing is
+	 * copied or fixed up, so it is ready as soon as it is constructed.
+	 * The memory must stay valid and 64-byte aligned (a mapping is
+	 * page aligned) as long as the view is used.
+	 */
+	template<typename T, typename Compare = std::less<T>>
+	class tree_image {
+		using layout = image_layout<T>;
+
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using const_reference = const T&;
+
+		class const_iterator {
+		public:
+			using iterator_category = std::bidirectional_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() noexcept :
+				image_(nullptr),
+				node_(layout::nil) {}
+
+			reference operator*() const {
+				return image_->data(node_);
+			}
+
+			pointer operator->() const {
+				return &(operator*());
+			}
+
+			const_iterator& operator++() {
+				std::uint32_t r = image_->link(node_, 1);
+				if (r != layout::nil) {
+					node_ = image_->leftmost(r);
+					return *this;
+				}
+				std::uint32_t p = image_->link(node_, 2);
+				while (p != layout::nil && image_->link(p, 1) == node_) {
+					node_ = p;
+					p = image_->link(p, 2);
+				}
+				node_ = p;
+				return *this;
+			}
+
+			const_iterator operator++(int) {
+				const_iterator temp = *this;
+				++*this;
+				return temp;
+			}
+
+			/* end() steps back to the maximum. */
+			const_iterator& operator--() {
+				if (node_ == layout::nil) {
+					node_ = image_->rightmost(image_->root_);
+					return *this;
+				}
+				std::uint32_t l = image_->link(node_, 0);
+				if (l != layout::nil) {
+					node_ = image_->rightmost(l);
+					return *this;
+				}
+				std::uint32_t p = image_->link(node_, 2);
+				while (p != layout::nil && image_->link(p, 0) == node_) {
+					node_ = p;
+					p = image_->link(p, 2);
+				}
+				node_ = p;
+				return *this;
+			}
+
+			const_iterator operator--(int) {
+				const_iterator temp = *this;
+				--*this;
+				return temp;
+			}
+
+			bool operator==(const const_iterator& rhs) const noexcept {
+				return node_ == rhs.node_;
+			}
+
+			bool operator!=(const const_iterator& rhs) const noexcept {
+				return node_ != rhs.node_;
+			}
+
+		private:
+			friend class tree_image;
+
+			const_iterator(const tree_image* image, std::uint32_t node) noexcept :
+				image_(image),
+				node_(node) {}
+
+			const tree_image* image_;
+			std::uint32_t node_;
+		};
+
+		using iterator = const_iterator;
+
+		/* Checks the header and the length, not the nodes. */
+		tree_image(const void* base, size_type len, const Compare& comp = Compare()) :
+			comp_(comp) {
+			static_assert(std::is_trivially_copyable<T>::value, "an image needs a trivially copyable T");
+			if (len < sizeof(image_header)) {
+				throw std::runtime_error("tree image is truncated");
+			}
+			image_header h;
+			std::memcpy(&h, base, sizeof(h));
+			if (std::memcmp(h.magic, "AVLI", 4) != 0 || h.version != layout::version) {
+				throw std::runtime_error("not a tree image");
+			}
+			if (h.value_size != sizeof(T) || h.stride != layout::stride ||
+				h.link_offset != layout::link_offset) {
+				throw std::runtime_error("tree image holds another element type");
+			}
+			if (reinterpret_cast<std::uintptr_t>(base) % 64) {
+				throw std::invalid_argument("tree image must be 64-byte aligned");
+			}
+			if ((len - sizeof(h)) / layout::stride < h.count) {
+				throw std::runtime_error("tree image is truncated");
+			}
+			nodes_ = static_cast<const unsigned char*>(base) + sizeof(h);
+			size_ = static_cast<size_type>(h.count);
+			root_ = h.root;
+		}
+
+		size_type size() const noexcept {
+			return size_;
+		}
+
+		bool empty() const noexcept {
+			return size_ == 0;
+		}
+
+		key_compare key_comp() const { return comp_; }
+
+		const_iterator begin() const noexcept {
+			return const_iterator(this, root_ == layout::nil ? root_ : leftmost(root_));
+		}
+
+		const_iterator end() const noexcept {
+			return const_iterator(this, layout::nil);
+		}
+
+		const_iterator cbegin() const noexcept {
+			return begin();
+		}
+
+		const_iterator cend() const noexcept {
+			return end();
+		}
+
+		template<typename K>
+		const_iterator find(const K& key) const {
+			std::uint32_t n = root_;
+			while (n != layout::nil) {
+				if (comp_(key, data(n))) {
+					n = link(n, 0);
+				}
+				else if (comp_(data(n), key)) {
+					n = link(n, 1);
+				}
+				else {
+					break;
+				}
+			}
+			return const_iterator(this, n);
+		}
+
+		template<typename K>
+		bool contains(const K& key) const {
+			return find(key) != end();
+		}
+
+		template<typename K>
+		size_type count(const K& key) const {
+			return contains(key) ? 1 : 0;
+		}
+
+		/* The first element not less than key. */
+		template<typename K>
+		const_iterator lower_bound(const K& key) const {
+			std::uint32_t n = root_, res = layout::nil;
+			while (n != layout::nil) {
+				if (comp_(data(n), key)) {
+					n = link(n, 1);
+				}
+				else {
+					res = n;
+					n = link(n, 0);
+				}
+			}
+			return const_iterator(this, res);
+		}
+
+		/* The first element greater than key. */
+		template<typename K>
+		const_iterator upper_bound(const K& key) const {
+			std::uint32_t n = root_, res = layout::nil;
+			while (n != layout::nil) {
+				if (comp_(key, data(n))) {
+					res = n;
+					n = link(n, 0);
+				}
+				else {
+					n = link(n, 1);
+				}
+			}
+			return const_iterator(this, res);
+		}
+
+	private:
+		const T& data(std::uint32_t n) const noexcept {
+			return *reinterpret_cast<const T*>(nodes_ + n * layout::stride);
+		}
+
+		/* 0 left, 1 right, 2 parent. */
+		std::uint32_t link(std::uint32_t n, int which) const noexcept {
+			std::uint32_t res;
+			std::memcpy(&res, nodes_ + n * layout::stride + layout::link_offset + which * 4, 4);
+			return res;
+		}
+
+		std::uint32_t leftmost(std::uint32_t n) const noexcept {
+			for (std::uint32_t l; (l = link(n, 0)) != layout::nil; n = l) {}
+			return n;
+		}
+
+		std::uint32_t rightmost(std::uint32_t n) const noexcept {
+			for (std::uint32_t r; (r = link(n, 1)) != layout::nil; n = r) {}
+			return n;
+		}
+
+		const unsigned char* nodes_;
+		size_type size_;
+		std::uint32_t root_;
+		Compare comp_;
+	};
+
+	/* A whole file mapped read-only and shared, unmapped on destruction. */
+	class mapped_file {
+	public:
+		explicit mapped_file(const char* path) {
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+			}
+			LARGE_INTEGER len;
+			if (!GetFileSizeEx(file, &len) || !len.QuadPart) {
+				CloseHandle(file);
+				throw std::runtime_error("can't map an empty file");
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping) {
+				throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+			}
+			data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (!data_) {
+				throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), path);
+			}
+			size_ = static_cast<std::size_t>(len.QuadPart);
+#else
+			int fd = ::open(path, O_RDONLY);
+			if (fd < 0) {
+				throw std::system_error(errno, std::generic_category(), path);
+			}
+			struct stat st;
+			if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+				::close(fd);
+				throw std::runtime_error("can't map an empty file");
+			}
+			size_ = static_cast<std::size_t>(st.st_size);
+			data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			int err = errno;
+			::close(fd);
+			if (data_ == MAP_FAILED) {
+				throw std::system_error(err, std::generic_category(), path);
+			}
+#endif
+		}
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		~mapped_file() noexcept {
+#if defined(_WIN32)
+			UnmapViewOfFile(data_);
+#else
+			::munmap(data_, size_);
+#endif
+		}
+
+		const void* data() const noexcept {
+			return data_;
+		}
+
+		std::size_t size() const noexcept {
+			return size_;
+		}
+
+	private:
+		void* data_;
+		std::size_t size_;
+	};
+
+	/* A tree image read straight from a mapped file. */
+	template<typename T, typename Compare = std::less<T>>
+	class mapped_tree : private mapped_file, public tree_image<T, Compare> {
+	public:
+		explicit mapped_tree(const char* path, const Compare& comp = Compare()) :
+			mapped_file(path),
+			tree_image<T, Compare>(mapped_file::data(), mapped_file::size(), comp) {}
+
+		using tree_image<T, Compare>::size;
+	};
+}
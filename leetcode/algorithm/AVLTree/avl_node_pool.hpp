@@ -0,0 +1,327 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+namespace avl {
+
+	struct slab_options {
+		/* Bytes requested from the system for every new chunk. */
+		std::size_t chunk_bytes = 64 * 1024;
+		/*
+		 * Back chunks with huge pages when the system allows it. On
+		 * linux MAP_HUGETLB is tried first, then a normal mapping with
+		 * MADV_HUGEPAGE. Otherwise it silently falls back to the heap.
+		 */
+		bool huge_pages = false;
+	};
+
+	/*
+	 * A slab of fixed-size blocks. The block size is fixed by the first
+	 * allocation, which is always a node for trees. Blocks are carved
+	 * from contiguous chunks by a bump pointer, and freed blocks go to
+	 * an intrusive free list:
+	 *
+	 *   chunk: [blk][blk][blk][blk][    ...    ]
+	 *                             ^cur_        ^end_
+	 *   free_: blk -> blk -> null
+	 *
+	 * Requests whose size doesn't match the block size go straight to
+	 * the heap, so the pool can be shared by rebound allocators.
+	 */
+	class slab_pool {
+	public:
+		explicit slab_pool(const slab_options& opt = slab_options()) noexcept :
+			opt_(opt) {}
+
+		slab_pool(const slab_pool&) = delete;
+		slab_pool& operator=(const slab_pool&) = delete;
+
+		~slab_pool() noexcept {
+			release();
+		}
+
+		void* allocate(std::size_t bytes, std::size_t align) {
+			if (!fix_block(bytes, align)) {
+				return ::operator new(bytes, std::align_val_t(align));
+			}
+			if (reserved_) {
+				reserved_--;
+				return bump();
+			}
+			if (free_) {
+				auto temp = free_;
+				free_ = free_->next;
+				return temp;
+			}
+			return bump();
+		}
+
+		void deallocate(void* p, std::size_t bytes, std::size_t align) noexcept {
+			if (bytes != request_ || align > align_) {
+				::operator delete(p, std::align_val_t(align));
+				return;
+			}
+			auto temp = static_cast<free_block*>(p);
+			temp->next = free_;
+			free_ = temp;
+		}
+
+		/*
+		 * Make sure the next n allocations are served by one contiguous
+		 * run of blocks in address order.
+		 */
+		void reserve(std::size_t n, std::size_t bytes, std::size_t align) {
+			if (!n || !fix_block(bytes, align)) return;
+			if (static_cast<std::size_t>(end_ - cur_) < n * block_) {
+				new_chunk(n * block_ > opt_.chunk_bytes ? n * block_ : opt_.chunk_bytes);
+			}
+			reserved_ = n;
+		}
+
+		/*
+		 * Take n contiguous blocks in address order at once, so threads
+		 * can fill them without calling the pool. Each one is given back
+		 * on its own like any other block. nullptr if the blocks are not
+		 * exactly 'bytes' apart, a pending reserve() is dropped.
+		 */
+		void* allocate_run(std::size_t n, std::size_t bytes, std::size_t align) {
+			if (!n || !fix_block(bytes, align) || block_ != bytes) return nullptr;
+			if (static_cast<std::size_t>(end_ - cur_) < n * block_) {
+				new_chunk(n * block_ > opt_.chunk_bytes ? n * block_ : opt_.chunk_bytes);
+			}
+			auto temp = cur_;
+			cur_ += n * block_;
+			reserved_ = 0;
+			return temp;
+		}
+
+		/* Give every chunk back at once, outstanding blocks included. */
+		void release() noexcept {
+			for (auto& c : chunks_) {
+				unmap_chunk(c);
+			}
+			chunks_.clear();
+			free_ = nullptr;
+			cur_ = end_ = nullptr;
+			reserved_ = 0;
+		}
+
+		const slab_options& options() const noexcept {
+			return opt_;
+		}
+
+		std::size_t block_size() const noexcept {
+			return block_;
+		}
+
+	private:
+		struct free_block {
+			free_block* next;
+		};
+
+		struct chunk {
+			void* base;
+			std::size_t bytes;
+			bool mapped;
+		};
+
+		bool fix_block(std::size_t bytes, std::size_t align) noexcept {
+			if (!request_) {
+				request_ = bytes;
+				align_ = align < alignof(free_block) ? alignof(free_block) : align;
+				block_ = bytes < sizeof(free_block) ? sizeof(free_block) : bytes;
+				block_ = (block_ + align_ - 1) / align_ * align_;
+			}
+			return bytes == request_ && align <= align_;
+		}
+
+		void* bump() {
+			if (cur_ == end_) {
+				new_chunk(opt_.chunk_bytes);
+			}
+			auto temp = cur_;
+			cur_ += block_;
+			return temp;
+		}
+
+		void new_chunk(std::size_t bytes) {
+			/* Keep the tail of the old chunk instead of wasting it. */
+			while (static_cast<std::size_t>(end_ - cur_) >= block_) {
+				auto temp = reinterpret_cast<free_block*>(cur_);
+				temp->next = free_;
+				free_ = temp;
+				cur_ += block_;
+			}
+			if (bytes < block_) bytes = block_;
+			chunk c = map_chunk(bytes);
+			chunks_.push_back(c);
+			cur_ = static_cast<char*>(c.base);
+			end_ = cur_ + c.bytes / block_ * block_;
+		}
+
+		chunk map_chunk(std::size_t bytes) {
+#if defined(__linux__)
+			if (opt_.huge_pages) {
+				const std::size_t huge = std::size_t(2) << 20;
+				std::size_t len = (bytes + huge - 1) / huge * huge;
+				void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+				p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+				if (p == MAP_FAILED) {
+					p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+					if (p != MAP_FAILED) {
+						::madvise(p, len, MADV_HUGEPAGE);
+					}
+#endif
+				}
+				if (p != MAP_FAILED) {
+					return { p, len, true };
+				}
+			}
+#elif defined(_WIN32)
+			if (opt_.huge_pages) {
+				std::size_t huge = ::GetLargePageMinimum();
+				if (huge) {
+					std::size_t len = (bytes + huge - 1) / huge * huge;
+					void* p = ::VirtualAlloc(nullptr, len,
+						MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+					if (p) {
+						return { p, len, true };
+					}
+				}
+			}
+#endif
+			return { ::operator new(bytes, std::align_val_t(align_)), bytes, false };
+		}
+
+		void unmap_chunk(const chunk& c) noexcept {
+			if (!c.mapped) {
+				::operator delete(c.base, std::align_val_t(align_));
+				return;
+			}
+#if defined(__linux__)
+			::munmap(c.base, c.bytes);
+#elif defined(_WIN32)
+			::VirtualFree(c.base, 0, MEM_RELEASE);
+#endif
+		}
+
+		slab_options opt_;
+		std::size_t request_ = 0;  /* size the block was fixed for */
+		std::size_t block_ = 0;    /* rounded block size */
+		std::size_t align_ = alignof(std::max_align_t);
+		std::size_t reserved_ = 0; /* blocks promised by reserve() */
+		free_block* free_ = nullptr;
+		char* cur_ = nullptr;
+		char* end_ = nullptr;
+		std::vector<chunk> chunks_;
+	};
+
+	/*
+	 * Allocator handing out blocks from a shared slab_pool. Copies and
+	 * rebound copies share the pool, a default constructed allocator
+	 * owns a new one. A copied container gets a fresh pool, so trees
+	 * never share a pool unless they are built from the same allocator.
+	 */
+	template<typename T>
+	class slab_allocator {
+	public:
+		using value_type = T;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+		using is_always_equal = std::false_type;
+
+		template<typename U>
+		struct rebind {
+			using other = slab_allocator<U>;
+		};
+
+		slab_allocator() :
+			pool_(std::make_shared<slab_pool>()) {}
+
+		explicit slab_allocator(const slab_options& opt) :
+			pool_(std::make_shared<slab_pool>(opt)) {}
+
+		/*
+		 * No move constructor on purpose, a moved-from allocator must
+		 * still be able to allocate.
+		 */
+		slab_allocator(const slab_allocator&) noexcept = default;
+		slab_allocator& operator=(const slab_allocator&) noexcept = default;
+
+		template<typename U>
+		slab_allocator(const slab_allocator<U>& rhs) noexcept :
+			pool_(rhs.pool_) {}
+
+		T* allocate(std::size_t n) {
+			return static_cast<T*>(pool_->allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T* p, std::size_t n) noexcept {
+			pool_->deallocate(p, n * sizeof(T), alignof(T));
+		}
+
+		slab_allocator select_on_container_copy_construction() const {
+			return slab_allocator(pool_->options());
+		}
+
+		void reserve(std::size_t n) {
+			pool_->reserve(n, sizeof(T), alignof(T));
+		}
+
+		/* n contiguous T, each freed alone, or nullptr (see slab_pool). */
+		T* allocate_run(std::size_t n) {
+			return static_cast<T*>(pool_->allocate_run(n, sizeof(T), alignof(T)));
+		}
+
+		/* True when nobody else can hold blocks of this pool. */
+		bool exclusive() const noexcept {
+			return pool_.use_count() == 1;
+		}
+
+		void release() noexcept {
+			pool_->release();
+		}
+
+		template<typename U>
+		bool operator==(const slab_allocator<U>& rhs) const noexcept {
+			return pool_ == rhs.pool_;
+		}
+
+		template<typename U>
+		bool operator!=(const slab_allocator<U>& rhs) const noexcept {
+			return !(*this == rhs);
+		}
+
+	private:
+		template<typename U> friend class slab_allocator;
+
+		std::shared_ptr<slab_pool> pool_;
+	};
+
+	template<typename A>
+	struct is_slab_allocator : std::false_type {};
+
+	template<typename T>
+	struct is_slab_allocator<slab_allocator<T>> : std::true_type {};
+}
@@ -0,0 +1,496 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "avl_epoch.hpp"
+
+namespace avl {
+
+	template<typename T>
+	struct persistent_node {
+		T data;
+		persistent_node* left;
+		persistent_node* right;
+		int height;
+		std::size_t size;
+		std::uint64_t stamp;  /* the update that created it */
+	};
+
+	/*
+	 * A persistent AVL set. Published nodes are never written again, an
+	 * update copies the path from the root down to the change and the
+	 * new version shares every other subtree with the old one:
+	 *
+	 *      old         new             insert(6): 5 and 7 are copied,
+	 *       5           5'             3 and 9 are shared, 6 is new.
+	 *      / \         / \
+	 *     3   7       3   7'           Rotations copy what they touch
+	 *        / \         / \           unless this update made it.
+	 *       .   9       6   9
+	 *
+	 * A version is published with one atomic store of its root, so a
+	 * reader takes a snapshot with a pin and a load, O(1), and keeps a
+	 * consistent view however long it reads. Writers take a mutex among
+	 * themselves and never wait for readers. The nodes an update copied
+	 * or removed are retired to an epoch_domain and freed once no
+	 * snapshot that could reach them is left.
+	 */
+	template<typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+	class persistent_tree {
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using allocator_type = Allocator;
+
+	private:
+		using node = persistent_node<T>;
+		using alloc_traits = std::allocator_traits<Allocator>;
+		using node_allocator = typename alloc_traits::template rebind_alloc<node>;
+		using node_alloc_traits = std::allocator_traits<node_allocator>;
+
+	public:
+		/*
+		 * An in-order walk keeps its path on a fixed stack. An AVL tree
+		 * of height 64 holds more than 2^44 nodes.
+		 */
+		static constexpr int max_height = 64;
+
+		class const_iterator {
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() noexcept :
+				depth_(0) {}
+
+			reference operator*() const noexcept {
+				return stack_[depth_ - 1]->data;
+			}
+
+			pointer operator->() const noexcept {
+				return &**this;
+			}
+
+			const_iterator& operator++() noexcept {
+				push_left(stack_[--depth_]->right);
+				return *this;
+			}
+
+			const_iterator operator++(int) noexcept {
+				const_iterator temp = *this;
+				++*this;
+				return temp;
+			}
+
+			bool operator==(const const_iterator& rhs) const noexcept {
+				return depth_ == rhs.depth_ &&
+					(!depth_ || stack_[depth_ - 1] == rhs.stack_[depth_ - 1]);
+			}
+
+			bool operator!=(const const_iterator& rhs) const noexcept {
+				return !(*this == rhs);
+			}
+
+		private:
+			friend class persistent_tree;
+
+			void push_left(const node* n) noexcept {
+				while (n) {
+					stack_[depth_++] = n;
+					n = n->left;
+				}
+			}
+
+			int depth_;
+			const node* stack_[max_height];
+		};
+
+		/*
+		 * A pinned version. It never changes and stays readable until it
+		 * is destroyed, whatever writers do meanwhile. It must not
+		 * outlive its tree.
+		 */
+		class snapshot {
+		public:
+			snapshot() noexcept :
+				root_(nullptr),
+				comp_(nullptr) {}
+
+			size_type size() const noexcept {
+				return root_ ? root_->size : 0;
+			}
+
+			bool empty() const noexcept {
+				return !root_;
+			}
+
+			const_iterator begin() const noexcept {
+				const_iterator it;
+				it.push_left(root_);
+				return it;
+			}
+
+			const_iterator end() const noexcept {
+				return const_iterator();
+			}
+
+			/* The stored element equal to key, or null. */
+			template<typename K>
+			const T* find(const K& key) const {
+				auto n = root_;
+				while (n) {
+					if ((*comp_)(key, n->data)) {
+						n = n->left;
+					}
+					else if ((*comp_)(n->data, key)) {
+						n = n->right;
+					}
+					else {
+						return &n->data;
+					}
+				}
+				return nullptr;
+			}
+
+			template<typename K>
+			bool contains(const K& key) const {
+				return find(key) != nullptr;
+			}
+
+		private:
+			friend class persistent_tree;
+
+			snapshot(epoch_domain::guard&& g, const node* root, const Compare* comp) noexcept :
+				guard_(std::move(g)),
+				root_(root),
+				comp_(comp) {}
+
+			epoch_domain::guard guard_;
+			const node* root_;
+			const Compare* comp_;
+		};
+
+		persistent_tree() :
+			root_(nullptr),
+			stamp_(0) {}
+
+		explicit persistent_tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			stamp_(0),
+			comp_(comp),
+			node_alloc_(alloc) {}
+
+		persistent_tree(const persistent_tree&) = delete;
+		persistent_tree& operator=(const persistent_tree&) = delete;
+
+		/* No snapshot may be alive any more. */
+		~persistent_tree() noexcept {
+			domain_.collect();
+			destroy_subtree(root_.load(std::memory_order_relaxed));
+		}
+
+		allocator_type get_allocator() const noexcept { return allocator_type(node_alloc_); }
+
+		key_compare key_comp() const { return comp_; }
+
+		/* Pin the current version. Lock free and O(1). */
+		snapshot get_snapshot() const {
+			auto g = domain_.pin();
+			return snapshot(std::move(g), root_.load(), &comp_);
+		}
+
+		size_type size() const {
+			return get_snapshot().size();
+		}
+
+		bool contains(const T& t) const {
+			return get_snapshot().contains(t);
+		}
+
+		bool insert(const T& t) {
+			return insert_native(t);
+		}
+
+		bool insert(T&& t) {
+			return insert_native(std::move(t));
+		}
+
+		/* Return true when t was found and removed. */
+		bool remove(const T& t) {
+			std::lock_guard<std::mutex> lock(writer_);
+			begin_update();
+			bool removed = false;
+			node* res;
+			try {
+				res = remove_native(root_.load(std::memory_order_relaxed), t, removed);
+			}
+			catch (...) {
+				abort_update();
+				throw;
+			}
+			if (!removed) {
+				return false;
+			}
+			publish(res);
+			return true;
+		}
+
+		/* Retire every node of the current version at once. */
+		void clear() {
+			std::lock_guard<std::mutex> lock(writer_);
+			node* old = root_.load(std::memory_order_relaxed);
+			if (!old) return;
+			root_.store(nullptr);
+			domain_.retire([this, old]() { destroy_subtree(old); });
+		}
+
+		/* Closures still waiting in the epoch domain, for diagnostics. */
+		size_type pending_retired() const {
+			return domain_.pending();
+		}
+
+	private:
+		template<typename V>
+		bool insert_native(V&& t) {
+			std::lock_guard<std::mutex> lock(writer_);
+			begin_update();
+			bool inserted = false;
+			node* res;
+			try {
+				res = insert_native(root_.load(std::memory_order_relaxed), t, inserted);
+			}
+			catch (...) {
+				abort_update();
+				throw;
+			}
+			if (!inserted) {
+				return false;
+			}
+			publish(res);
+			return true;
+		}
+
+		/*
+		 * Return the new subtree for n, which is n itself when t is
+		 * already there. Only the descent path is copied.
+		 */
+		template<typename V>
+		node* insert_native(node* n, V& t, bool& inserted) {
+			if (!n) {
+				inserted = true;
+				return create_node(std::forward<V>(t), nullptr, nullptr);
+			}
+			if (comp_(t, n->data)) {
+				node* l = insert_native(n->left, t, inserted);
+				if (!inserted) return n;
+				n = own(n);
+				n->left = l;
+			}
+			else if (comp_(n->data, t)) {
+				node* r = insert_native(n->right, t, inserted);
+				if (!inserted) return n;
+				n = own(n);
+				n->right = r;
+			}
+			else {
+				return n;
+			}
+			return rebalance(n);
+		}
+
+		/*
+		 * The removed node is retired, not copied. With two children its
+		 * place is taken by a copy of its successor, which leaves the
+		 * right subtree the same way.
+		 */
+		template<typename K>
+		node* remove_native(node* n, const K& key, bool& removed) {
+			if (!n) {
+				return nullptr;
+			}
+			if (comp_(key, n->data)) {
+				node* l = remove_native(n->left, key, removed);
+				if (!removed) return n;
+				n = own(n);
+				n->left = l;
+				return rebalance(n);
+			}
+			if (comp_(n->data, key)) {
+				node* r = remove_native(n->right, key, removed);
+				if (!removed) return n;
+				n = own(n);
+				n->right = r;
+				return rebalance(n);
+			}
+			removed = true;
+			retire(n);
+			if (!n->left) return n->right;
+			if (!n->right) return n->left;
+			node* succ;
+			node* r = remove_min(n->right, succ);
+			node* res = create_node(succ->data, n->left, r);
+			retire(succ);
+			return rebalance(res);
+		}
+
+		node* remove_min(node* n, node*& min) {
+			if (!n->left) {
+				min = n;
+				return n->right;
+			}
+			node* l = remove_min(n->left, min);
+			n = own(n);
+			n->left = l;
+			return rebalance(n);
+		}
+
+		/* n as a node this update may write: itself or a fresh copy. */
+		node* own(node* n) {
+			if (n->stamp == stamp_) {
+				return n;
+			}
+			node* res = create_node(n->data, n->left, n->right);
+			retire(n);
+			return res;
+		}
+
+		/* n is owned, its children may still be shared. */
+		node* rebalance(node* n) {
+			update(n);
+			int factor = get_height(n->left) - get_height(n->right);
+			if (factor > 1) {
+				if (get_height(n->left->left) < get_height(n->left->right)) {
+					n->left = rotate_left(own(n->left));
+				}
+				return rotate_right(n);
+			}
+			if (factor < -1) {
+				if (get_height(n->right->right) < get_height(n->right->left)) {
+					n->right = rotate_right(own(n->right));
+				}
+				return rotate_left(n);
+			}
+			return n;
+		}
+
+		node* rotate_right(node* n) {
+			node* l = own(n->left);
+			n->left = l->right;
+			l->right = n;
+			update(n);
+			update(l);
+			return l;
+		}
+
+		node* rotate_left(node* n) {
+			node* r = own(n->right);
+			n->right = r->left;
+			r->left = n;
+			update(n);
+			update(r);
+			return r;
+		}
+
+		static int get_height(const node* n) noexcept {
+			return n ? n->height : 0;
+		}
+
+		static std::size_t get_size(const node* n) noexcept {
+			return n ? n->size : 0;
+		}
+
+		static void update(node* n) noexcept {
+			int l = get_height(n->left), r = get_height(n->right);
+			n->height = 1 + (l > r ? l : r);
+			n->size = 1 + get_size(n->left) + get_size(n->right);
+		}
+
+		void begin_update() {
+			stamp_++;
+			fresh_.clear();
+			replaced_.clear();
+		}
+
+		/* Nothing was published, drop the copies and keep the old nodes. */
+		void abort_update() noexcept {
+			for (auto n : fresh_) {
+				destroy_node(n);
+			}
+			fresh_.clear();
+			replaced_.clear();
+		}
+
+		/*
+		 * The store is sequentially consistent, see epoch_domain::pin().
+		 * Only then are the replaced nodes handed to the domain.
+		 */
+		void publish(node* root) {
+			root_.store(root);
+			fresh_.clear();
+			if (replaced_.empty()) return;
+			auto dead = std::make_shared<std::vector<node*>>(std::move(replaced_));
+			replaced_.clear();
+			domain_.retire([this, dead]() {
+				for (auto n : *dead) {
+					destroy_node(n);
+				}
+			});
+		}
+
+		void retire(node* n) {
+			replaced_.push_back(n);
+		}
+
+		template<typename V>
+		node* create_node(V&& t, node* left, node* right) {
+			fresh_.reserve(fresh_.size() + 1);
+			replaced_.reserve(replaced_.size() + 1);
+			node* res = node_alloc_traits::allocate(node_alloc_, 1);
+			try {
+				node_alloc_traits::construct(node_alloc_, std::addressof(res->data),
+					std::forward<V>(t));
+			}
+			catch (...) {
+				node_alloc_traits::deallocate(node_alloc_, res, 1);
+				throw;
+			}
+			res->left = left;
+			res->right = right;
+			res->stamp = stamp_;
+			update(res);
+			fresh_.push_back(res);
+			return res;
+		}
+
+		void destroy_node(node* n) noexcept {
+			node_alloc_traits::destroy(node_alloc_, std::addressof(n->data));
+			node_alloc_traits::deallocate(node_alloc_, n, 1);
+		}
+
+		void destroy_subtree(node* n) noexcept {
+			if (!n) return;
+			destroy_subtree(n->left);
+			destroy_subtree(n->right);
+			destroy_node(n);
+		}
+
+		std::atomic<node*> root_;    /* the published version */
+		std::uint64_t stamp_;        /* current update, under writer_ */
+		std::vector<node*> fresh_;   /* created by this update */
+		std::vector<node*> replaced_; /* unlinked by this update */
+		Compare comp_;
+		node_allocator node_alloc_;
+		std::mutex writer_;
+		mutable epoch_domain domain_;
+	};
+}
@@ -0,0 +1,332 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include "avl_tree_plus.hpp"
+
+namespace avl {
+
+	/*
+	 * Partitions decide which shard a key lives in. A hash partition
+	 * spreads any key set evenly, the hash is mixed first since
+	 * std::hash of an integer is often the integer itself and would
+	 * send strided keys to the same shard.
+	 */
+	template<typename T, typename Hash = std::hash<T>>
+	struct hash_partition {
+		Hash hash;
+
+		std::size_t operator()(const T& t, std::size_t shards) const {
+			std::uint64_t h = static_cast<std::uint64_t>(hash(t));
+			h *= 0x9E3779B97F4A7C15ull;
+			return static_cast<std::size_t>((h >> 32) % shards);
+		}
+	};
+
+	/*
+	 * A range partition cuts the key space at N - 1 sorted bounds, shard
+	 * i holds the keys in [bounds[i - 1], bounds[i]). Neighbouring keys
+	 * stay together, which suits range scans, but the bounds have to
+	 * fit the keys or one shard takes all the load.
+	 */
+	template<typename T, std::size_t N, typename Compare = std::less<T>>
+	struct range_partition {
+		std::array<T, N - 1> bounds;
+		Compare comp;
+
+		std::size_t operator()(const T& t, std::size_t) const {
+			return static_cast<std::size_t>(
+				std::upper_bound(bounds.begin(), bounds.end(), t, comp) - bounds.begin());
+		}
+	};
+
+	/*
+	 * N independent trees, each behind its own reader/writer lock. An
+	 * operation on one key locks the one shard the partition picks, so
+	 * threads working on different shards never meet:
+	 *
+	 *   shard:   0          1          2          3
+	 *          [lock]     [lock]     [lock]     [lock]   one cache line
+	 *          [tree]     [tree]     [tree]     [tree]   each
+	 *             ^          ^                     ^
+	 *          insert(8)  find(5)              erase(3)
+	 *
+	 * Every shard starts on its own cache line, so taking one lock
+	 * doesn't invalidate the line of the lock next to it.
+	 *
+	 * Whole-set reads go through a view, which holds every shard shared
+	 * in index order and walks them in ascending order with a k-way
+	 * merge. Writers only ever hold one lock, so this can't deadlock.
+	 */
+	template<typename T, std::size_t N, typename Compare = std::less<T>,
+		typename Partition = hash_partition<T>, typename Allocator = std::allocator<T>>
+	class sharded_tree {
+		static_assert(N > 0, "a sharded tree needs a shard");
+
+		using tree_type = tree<T, Compare, Allocator>;
+
+		struct alignas(64) shard {
+			mutable std::shared_mutex mutex;
+			tree_type tree;
+
+			shard(const Compare& comp, const Allocator& alloc) :
+				tree(comp, alloc) {}
+		};
+
+	public:
+		using value_type = T;
+		using size_type = std::size_t;
+		using key_compare = Compare;
+		using partition_type = Partition;
+
+		class view;
+
+		explicit sharded_tree(const Partition& part = Partition(),
+			const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+			sharded_tree(part, comp, alloc, std::make_index_sequence<N>()) {}
+
+		sharded_tree(const sharded_tree&) = delete;
+		sharded_tree& operator=(const sharded_tree&) = delete;
+
+		static constexpr size_type shards() noexcept {
+			return N;
+		}
+
+		size_type shard_of(const T& t) const {
+			return part_(t, N);
+		}
+
+		/* false if an equal element was there already. */
+		bool insert(const T& t) {
+			auto& s = shards_[shard_of(t)];
+			std::unique_lock<std::shared_mutex> lock(s.mutex);
+			size_type old = s.tree.size();
+			s.tree.insert(t);
+			return s.tree.size() != old;
+		}
+
+		bool insert(T&& t) {
+			auto& s = shards_[shard_of(t)];
+			std::unique_lock<std::shared_mutex> lock(s.mutex);
+			size_type old = s.tree.size();
+			s.tree.insert(std::move(t));
+			return s.tree.size() != old;
+		}
+
+		/* The element is built first, the partition needs it. */
+		template<typename ...Args>
+		bool emplace(Args&&... args) {
+			return insert(T(std::forward<Args>(args)...));
+		}
+
+		size_type erase(const T& t) {
+			auto& s = shards_[shard_of(t)];
+			std::unique_lock<std::shared_mutex> lock(s.mutex);
+			auto it = s.tree.find(t);
+			if (it == s.tree.end()) return 0;
+			s.tree.erase(it);
+			return 1;
+		}
+
+		bool contains(const T& t) const {
+			auto& s = shards_[shard_of(t)];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			return s.tree.contains(t);
+		}
+
+		size_type count(const T& t) const {
+			return contains(t) ? 1 : 0;
+		}
+
+		/*
+		 * Call f with the element equal to t while its shard is held
+		 * shared. No reference can leave the lock safely, so this is
+		 * the way to read more than presence.
+		 */
+		template<typename F>
+		bool visit(const T& t, F&& f) const {
+			auto& s = shards_[shard_of(t)];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			auto it = s.tree.find(t);
+			if (it == s.tree.end()) return false;
+			f(*it);
+			return true;
+		}
+
+		/* The shards are read one after another, not at one instant. */
+		size_type size() const {
+			size_type res = 0;
+			for (size_type i = 0; i < N; i++) {
+				res += size(i);
+			}
+			return res;
+		}
+
+		size_type size(size_type i) const {
+			std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+			return shards_[i].tree.size();
+		}
+
+		bool empty() const {
+			return size() == 0;
+		}
+
+		void clear() {
+			for (auto& s : shards_) {
+				std::unique_lock<std::shared_mutex> lock(s.mutex);
+				s.tree.clear();
+			}
+		}
+
+		/* A consistent ordered view of the whole set. */
+		view read() const {
+			return view(*this);
+		}
+
+		/* Visit every element in ascending order under one view. */
+		template<typename F>
+		void for_each(F&& f) const {
+			auto v = read();
+			for (const auto& t : v) {
+				f(t);
+			}
+		}
+
+		/*
+		 * Holds every shard shared while it lives. Its iterator merges
+		 * the N shard iterators: a heap of the shards keyed by their
+		 * current element, the top is the next one in order.
+		 *
+		 *   shard 0: 1 4 9        heap: (1,s0) (2,s1) (3,s2)
+		 *   shard 1: 2 5          pop 1, advance s0, push (4,s0)
+		 *   shard 2: 3 7 8        pop 2, advance s1, push (5,s1) ...
+		 */
+		class view {
+		public:
+			class const_iterator {
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = T;
+				using difference_type = std::ptrdiff_t;
+				using pointer = const T*;
+				using reference = const T&;
+
+				const_iterator() :
+					owner_(nullptr),
+					heap_size_(0) {}
+
+				reference operator*() const {
+					return *cur_[heap_[0]];
+				}
+
+				pointer operator->() const {
+					return &(operator*());
+				}
+
+				const_iterator& operator++() {
+					auto less = heap_less();
+					std::pop_heap(heap_.begin(), heap_.begin() + heap_size_, less);
+					size_type i = heap_[heap_size_ - 1];
+					if (++cur_[i] == owner_->shards_[i].tree.end()) {
+						heap_size_--;
+					}
+					else {
+						std::push_heap(heap_.begin(), heap_.begin() + heap_size_, less);
+					}
+					return *this;
+				}
+
+				const_iterator operator++(int) {
+					const_iterator temp = *this;
+					++*this;
+					return temp;
+				}
+
+				/* Positions compare by what is left to walk. */
+				bool operator==(const const_iterator& rhs) const {
+					if (heap_size_ != rhs.heap_size_) return false;
+					return !heap_size_ || cur_[heap_[0]] == rhs.cur_[rhs.heap_[0]];
+				}
+
+				bool operator!=(const const_iterator& rhs) const {
+					return !(*this == rhs);
+				}
+
+			private:
+				friend class view;
+				using shard_iterator = typename tree_type::const_iterator;
+
+				explicit const_iterator(const sharded_tree* owner) :
+					owner_(owner),
+					heap_size_(0) {
+					for (size_type i = 0; i < N; i++) {
+						cur_[i] = owner->shards_[i].tree.begin();
+						if (cur_[i] != owner->shards_[i].tree.end()) {
+							heap_[heap_size_++] = i;
+						}
+					}
+					std::make_heap(heap_.begin(), heap_.begin() + heap_size_, heap_less());
+				}
+
+				/* std heaps put the largest on top, so compare reversed. */
+				auto heap_less() const {
+					return [this](size_type a, size_type b) {
+						return owner_->comp_(*cur_[b], *cur_[a]);
+					};
+				}
+
+				const sharded_tree* owner_;
+				std::array<shard_iterator, N> cur_;
+				std::array<size_type, N> heap_;
+				size_type heap_size_;
+			};
+
+			const_iterator begin() const {
+				return const_iterator(owner_);
+			}
+
+			const_iterator end() const {
+				return const_iterator();
+			}
+
+			size_type size() const noexcept {
+				size_type res = 0;
+				for (auto& s : owner_->shards_) {
+					res += s.tree.size();
+				}
+				return res;
+			}
+
+		private:
+			friend class sharded_tree;
+
+			explicit view(const sharded_tree& owner) :
+				owner_(&owner) {
+				for (size_type i = 0; i < N; i++) {
+					locks_[i] = std::shared_lock<std::shared_mutex>(owner.shards_[i].mutex);
+				}
+			}
+
+			const sharded_tree* owner_;
+			std::array<std::shared_lock<std::shared_mutex>, N> locks_;
+		};
+
+	private:
+		template<std::size_t ...I>
+		sharded_tree(const Partition& part, const Compare& comp, const Allocator& alloc,
+			std::index_sequence<I...>) :
+			shards_{ { (static_cast<void>(I), shard(comp, alloc))... } },
+			part_(part),
+			comp_(comp) {}
+
+		std::array<shard, N> shards_;
+		Partition part_;
+		Compare comp_;
+	};
+}
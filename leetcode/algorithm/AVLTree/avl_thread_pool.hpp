@@ -0,0 +1,213 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace avl {
+
+	/*
+	 * A small fork-join pool for the divide and conquer algorithms of
+	 * the tree. fork2() queues one closure, runs the other one on the
+	 * calling thread, and keeps running queued closures until its own
+	 * one is finished. So a thread waiting on a nested fork never sits
+	 * idle and the pool can't deadlock on itself.
+	 *
+	 * Every worker has a queue of its own, threads outside the pool
+	 * share queue 0. A thread pushes and pops at the back of its queue,
+	 * so it takes back the newest closure, most likely the one it just
+	 * queued, with its data still in cache. A thread out of work steals
+	 * from the front of the other queues, which holds the oldest and so
+	 * the largest piece of a recursion:
+	 *
+	 *   queue 1: [big] [mid] [small]  <- worker 1 pushes and pops here
+	 *              ^
+	 *              worker 2 steals here when its queue 2 is empty
+	 *
+	 * Forks on different workers touch different locks, and a split
+	 * recursion spreads over the threads after a few steals.
+	 */
+	class thread_pool {
+		struct alignas(64) task_queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		/* The pool and queue of the calling thread, if it's a worker. */
+		struct worker_id {
+			const thread_pool* pool = nullptr;
+			unsigned index = 0;
+		};
+
+	public:
+		explicit thread_pool(unsigned threads = std::thread::hardware_concurrency()) :
+			queues_(threads > 1 ? threads : 1) {
+			for (unsigned i = 1; i < threads; i++) {
+				workers_.emplace_back([this, i]() { work(i); });
+			}
+		}
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		~thread_pool() noexcept {
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex_);
+				stop_ = true;
+			}
+			cv_.notify_all();
+			for (auto& w : workers_) {
+				w.join();
+			}
+		}
+
+		/* The pool shared by every tree. */
+		static thread_pool& instance() {
+			static thread_pool pool;
+			return pool;
+		}
+
+		/* Threads working on a fork, the caller included. */
+		unsigned concurrency() const noexcept {
+			return static_cast<unsigned>(workers_.size()) + 1;
+		}
+
+		/*
+		 * Run f and g, possibly at the same time, and return when both
+		 * are done. An exception of either one is rethrown here.
+		 */
+		template<typename F, typename G>
+		void fork2(F&& f, G&& g) {
+			if (workers_.empty()) {
+				f();
+				g();
+				return;
+			}
+			std::atomic<bool> done(false);
+			std::exception_ptr error;
+			push([&]() {
+				try {
+					f();
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				done.store(true, std::memory_order_release);
+			});
+			try {
+				g();
+			}
+			catch (...) {
+				/* The queued closure refers to this frame. */
+				wait(done);
+				throw;
+			}
+			wait(done);
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		static worker_id& current() noexcept {
+			thread_local worker_id id;
+			return id;
+		}
+
+		unsigned self() const noexcept {
+			const worker_id& id = current();
+			return id.pool == this ? id.index : 0;
+		}
+
+		/*
+		 * pending_ counts the queued closures of all queues. It changes
+		 * under the lock of the queue that changes, so it's never behind
+		 * a queue a sleeping worker should look at.
+		 */
+		void push(std::function<void()> fn) {
+			task_queue& q = queues_[self()];
+			{
+				std::lock_guard<std::mutex> lock(q.mutex);
+				q.tasks.push_back(std::move(fn));
+				pending_.fetch_add(1, std::memory_order_release);
+			}
+			/* A worker between its check and its sleep must see the push. */
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex_);
+			}
+			cv_.notify_one();
+		}
+
+		bool take(task_queue& q, bool newest, std::function<void()>& fn) {
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (q.tasks.empty()) {
+				return false;
+			}
+			if (newest) {
+				fn = std::move(q.tasks.back());
+				q.tasks.pop_back();
+			}
+			else {
+				fn = std::move(q.tasks.front());
+				q.tasks.pop_front();
+			}
+			pending_.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/* Run the newest closure of our queue, or steal the oldest one of another. */
+		bool run_one() {
+			if (!pending_.load(std::memory_order_acquire)) {
+				return false;
+			}
+			std::function<void()> fn;
+			unsigned i = self();
+			unsigned n = static_cast<unsigned>(queues_.size());
+			bool found = take(queues_[i], true, fn);
+			for (unsigned k = 1; !found && k < n; k++) {
+				found = take(queues_[(i + k) % n], false, fn);
+			}
+			if (!found) {
+				return false;
+			}
+			fn();
+			return true;
+		}
+
+		void wait(const std::atomic<bool>& done) {
+			while (!done.load(std::memory_order_acquire)) {
+				if (!run_one()) {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		void work(unsigned index) {
+			current() = { this, index };
+			while (1) {
+				if (run_one()) {
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleep_mutex_);
+				cv_.wait(lock, [this]() {
+					return stop_ || pending_.load(std::memory_order_acquire);
+				});
+				if (stop_ && !pending_.load(std::memory_order_acquire)) {
+					return;
+				}
+			}
+		}
+
+		std::vector<task_queue> queues_;
+		std::atomic<std::size_t> pending_{ 0 };
+		std::mutex sleep_mutex_;
+		std::condition_variable cv_;
+		std::vector<std::thread> workers_;
+		bool stop_ = false;
+	};
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+namespace avl {
+
+	enum class traverse_order {
+		pre,
+		in,
+		post,
+		level,
+	};
+
+	/*
+	 * Iterative walks over AVL nodes with 'left', 'right' and 'height'
+	 * members. The visitor is a template parameter, so it inlines into
+	 * the loop, and the path lives on a stack of max_height entries in
+	 * the frame, so a walk never allocates.
+	 *
+	 * A visitor returning bool stops the walk with false, the walk then
+	 * returns false too. A visitor returning anything else sees every
+	 * node.
+	 *
+	 * The depth-first walks prefetch the node they go to next before
+	 * the visitor runs, so it's on its way while the visitor works.
+	 * Level order reads the heights of both children anyway.
+	 */
+	template<typename Node>
+	class traversal {
+	public:
+		/*
+		 * No walk holds more than one entry per level. An AVL tree of
+		 * height 64 holds more than 2^44 nodes.
+		 */
+		static constexpr int max_height = 64;
+
+		/*
+		 * Root, left, right. Only right children wait on the stack:
+		 *
+		 *        a          visit a, push c, go to b
+		 *       / \         visit b, push e, go to d
+		 *      b   c        visit d, pop e ...
+		 *     / \
+		 *    d   e
+		 */
+		template<typename Visit>
+		static bool pre_order(Node* root, Visit&& visit) {
+			Node* stack[max_height];
+			int top = 0;
+			Node* node = root;
+			while (node || top) {
+				if (!node) {
+					node = stack[--top];
+				}
+				prefetch(node->left);
+				if (!call(visit, node)) return false;
+				if (node->right) {
+					if (node->left) {
+						prefetch(node->right);
+						stack[top++] = node->right;
+					}
+					else {
+						node = node->right;
+						continue;
+					}
+				}
+				node = node->left;
+			}
+			return true;
+		}
+
+		/* Left, root, right: the order of the keys. */
+		template<typename Visit>
+		static bool in_order(Node* root, Visit&& visit) {
+			Node* stack[max_height];
+			int top = 0;
+			Node* node = root;
+			while (1) {
+				while (node) {
+					stack[top++] = node;
+					node = node->left;
+				}
+				if (!top) break;
+				node = stack[--top];
+				prefetch(node->right);
+				if (!call(visit, node)) return false;
+				node = node->right;
+			}
+			return true;
+		}
+
+		/*
+		 * Left, right, root. A node stays on the stack until its right
+		 * subtree is done, which is when the node visited last is its
+		 * right child, or it has none.
+		 */
+		template<typename Visit>
+		static bool post_order(Node* root, Visit&& visit) {
+			Node* stack[max_height];
+			int top = 0;
+			Node* node = root;
+			Node* prev = nullptr;
+			while (1) {
+				while (node) {
+					stack[top++] = node;
+					prefetch(node->right);
+					node = node->left;
+				}
+				if (!top) break;
+				Node* peek = stack[top - 1];
+				if (peek->right && peek->right != prev) {
+					node = peek->right;
+					continue;
+				}
+				if (!call(visit, peek)) return false;
+				prev = peek;
+				top--;
+			}
+			return true;
+		}
+
+		/*
+		 * Top down, each level from left to right. A queue would hold a
+		 * whole level, so the walk goes deeper one level at a time
+		 * instead: for level k it descends to depth k only, and skips a
+		 * subtree whose height shows it ends above k.
+		 *
+		 *   k = 0:  a               Every node is reached once per
+		 *   k = 1:  a b c           level its subtree spans, which is
+		 *   k = 2:  a b d e c ...   its height. Heights sum to O(n) in
+		 *                           an AVL tree, about 2n visits.
+		 */
+		template<typename Visit>
+		static bool level_order(Node* root, Visit&& visit) {
+			if (!root) return true;
+			Node* stack[max_height + 1];
+			int depth[max_height + 1];
+			for (int level = 0; level < root->height; level++) {
+				int top = 0;
+				stack[top] = root;
+				depth[top++] = 0;
+				while (top) {
+					top--;
+					Node* node = stack[top];
+					int d = depth[top];
+					if (d == level) {
+						if (!call(visit, node)) return false;
+						continue;
+					}
+					/* Left goes on top, so it comes out first. */
+					if (node->right && d + node->right->height >= level) {
+						stack[top] = node->right;
+						depth[top++] = d + 1;
+					}
+					if (node->left && d + node->left->height >= level) {
+						stack[top] = node->left;
+						depth[top++] = d + 1;
+					}
+				}
+			}
+			return true;
+		}
+
+		template<typename Visit>
+		static bool walk(traverse_order order, Node* root, Visit&& visit) {
+			switch (order) {
+			case traverse_order::pre:
+				return pre_order(root, visit);
+			case traverse_order::in:
+				return in_order(root, visit);
+			case traverse_order::post:
+				return post_order(root, visit);
+			case traverse_order::level:
+				return level_order(root, visit);
+			}
+			return true;
+		}
+
+	private:
+		template<typename Visit>
+		static bool call(Visit& visit, Node* node) {
+			if constexpr (std::is_same<decltype(visit(node)), bool>::value) {
+				return visit(node);
+			}
+			else {
+				visit(node);
+				return true;
+			}
+		}
+
+		/* A hint only, it never faults, a null node is fine. */
+		static void prefetch(const Node* node) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+			__builtin_prefetch(node);
+#elif defined(_MSC_VER)
+			_mm_prefetch(reinterpret_cast<const char*>(node), _MM_HINT_T0);
+#else
+			(void)node;
+#endif
+		}
+	};
+}
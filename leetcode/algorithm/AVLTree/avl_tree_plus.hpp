@@ -3,15 +3,30 @@
 #include <string>
 #include <type_traits>
 #include <functional>
-#include <queue>
-#include <stack>
 #include <array>
+#include <stdexcept>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#if defined(__cpp_impl_three_way_comparison) && __has_include(<compare>)
+#include <compare>
+#endif
+#include "avl_node_pool.hpp"
+#include "avl_frozen_tree.hpp"
+#include "avl_thread_pool.hpp"
+#include "avl_tree_stats.hpp"
+#include "avl_traverse.hpp"
 
 namespace avl {
 
 #define DEBUG_OUTPUT
-#define DEBUG_RECURISE_MODE
-#undef DEBUG_RECURISE_MODE
 
 #ifdef DEBUG_OUTPUT
 	enum class DEBUG_OUTPUT_METHOD {
@@ -23,9 +38,43 @@ namespace avl {
 	};
 #endif
 
+	/*
+	 * Tag telling the range constructors and assign() that the input
+	 * is already sorted in ascending order without duplicates.
+	 */
+	struct sorted_unique_t {
+		explicit sorted_unique_t() = default;
+	};
+	inline constexpr sorted_unique_t sorted_unique{};
+
+	/* Tag asking assign() to sort unsorted input on several threads. */
+	struct parallel_t {
+		explicit parallel_t() = default;
+	};
+	inline constexpr parallel_t parallel{};
+
 	template<typename T> struct tree_node_base;
 	template<typename T> struct tree_node;
 
+	/*
+	 * When the comparator is plain std::less, a single 'a <=> b' tells
+	 * less, equal and greater apart, so a descent can stop on an equal
+	 * key with one comparison per level. Other comparators only give
+	 * 'less', and the descents defer the equality test to the end.
+	 */
+	template<typename Compare, typename T, typename K, typename = void>
+	struct three_way_less : std::false_type {};
+
+#if defined(__cpp_lib_three_way_comparison) && defined(__cpp_lib_concepts)
+	template<typename T, typename K>
+	struct three_way_less<std::less<T>, T, K, std::enable_if_t<
+		std::three_way_comparable_with<T, K>>> : std::true_type {};
+
+	template<typename T, typename K>
+	struct three_way_less<std::less<>, T, K, std::enable_if_t<
+		std::three_way_comparable_with<T, K>>> : std::true_type {};
+#endif
+
 	template<typename T>
 	struct node_traits {
 		using base_ptr = tree_node_base<T>*;
@@ -38,12 +87,14 @@ namespace avl {
 		using node_ptr = typename node_traits<T>::node_ptr;
 
 		int height;
+		std::size_t size; /* node count of the subtree rooted here */
 		base_ptr left;
 		base_ptr right;
 		base_ptr parent;
 
 		tree_node_base() noexcept : 
-			height(1) {}
+			height(1),
+			size(1) {}
 
 		base_ptr self() {
 			return static_cast<base_ptr>(&*this);
@@ -56,8 +107,15 @@ namespace avl {
 		int update_height() {
 			height = 1 + std::max(this->left ? this->left->height : 0,
 				this->right ? this->right->height : 0);
+			update_size();
 			return height;
 		}
+
+		std::size_t update_size() {
+			size = 1 + (this->left ? this->left->size : 0) +
+				(this->right ? this->right->size : 0);
+			return size;
+		}
 	};
 
 	template<typename T>
@@ -89,13 +147,49 @@ namespace avl {
 		}
 	};
 
+	/*
+	 * Node of a threaded tree. It is also linked to its neighbours in
+	 * order, so an iterator steps with one load instead of a walk down
+	 * or up the tree:
+	 *
+	 *          4              prev/next:
+	 *        /   \
+	 *       2     6           1 <-> 2 <-> 3 <-> 4 <-> 5 <-> 6 <-> 7
+	 *      / \   / \
+	 *     1   3 5   7
+	 *
+	 * Rotations keep the order, so only linking and unlinking a node
+	 * touch the threads.
+	 */
+	template<typename T>
+	struct threaded_node : public tree_node<T> {
+		using base_ptr = typename node_traits<T>::base_ptr;
+
+		base_ptr prev;
+		base_ptr next;
+
+		static threaded_node* of(base_ptr node) noexcept {
+			return static_cast<threaded_node*>(node->as_node());
+		}
+	};
+
+	/* The first and last node of a threaded tree, nothing otherwise. */
+	template<typename T, bool Threaded>
+	struct tree_ends {};
+
 	template<typename T>
+	struct tree_ends<T, true> {
+		typename node_traits<T>::base_ptr leftmost_ = nullptr;
+		typename node_traits<T>::base_ptr rightmost_ = nullptr;
+	};
+
+	template<typename T, bool Threaded = false>
 	class tree_iterator : public std::iterator<std::bidirectional_iterator_tag, T> {
 	public:
 		using value_type = T;
 		using pointer    = T*;
 		using reference  = T&;
-		using self       = tree_iterator<T>;
+		using self       = tree_iterator<T, Threaded>;
 		using base_ptr   = typename node_traits<T>::base_ptr;
 		using node_ptr   = typename node_traits<T>::node_ptr;
 
@@ -125,6 +219,10 @@ namespace avl {
 		}
 
 		self& operator++() { /* post-increment */
+			if constexpr (Threaded) {
+				node_ = threaded_node<T>::of(node_)->next;
+				return *this;
+			}
 			/*
 			 *         A
 			 *        / \
@@ -196,6 +294,10 @@ namespace avl {
 		}
 
 		self& operator--() { /* pre-increment */
+			if constexpr (Threaded) {
+				node_ = threaded_node<T>::of(node_)->prev;
+				return *this;
+			}
 			if (node_->left) {
 				node_ = node_->left;
 				while (node_->right) {
@@ -224,7 +326,7 @@ namespace avl {
 			return temp;
 		}
 
-		reference operator=(const self& rhs) { node_ = rhs.node_; return *this; }
+		self& operator=(const self& rhs) { node_ = rhs.node_; return *this; }
 
 		bool operator>(const self& rhs) { 
 			return **this > *rhs; 
@@ -245,13 +347,13 @@ namespace avl {
 		base_ptr node_;
 	};
 
-	template<typename T>
+	template<typename T, bool Threaded = false>
 	struct const_tree_iterator : public std::iterator<std::bidirectional_iterator_tag, T> {
 	public:
 		using value_type = T;
 		using pointer    = const T*;
 		using reference  = const T&;
-		using self       = const_tree_iterator<T>;
+		using self       = const_tree_iterator<T, Threaded>;
 		using base_ptr   = typename node_traits<T>::base_ptr;
 		using node_ptr   = typename node_traits<T>::node_ptr;
 
@@ -267,9 +369,9 @@ namespace avl {
 			node_(std::move(rhs.node_)) {
 			rhs.node_ = nullptr;
 		}
-		const_tree_iterator(const tree_iterator<T>& rhs) :
+		const_tree_iterator(const tree_iterator<T, Threaded>& rhs) :
 			node_(rhs.node_) {}
-		const_tree_iterator(tree_iterator<T>&& rhs) :
+		const_tree_iterator(tree_iterator<T, Threaded>&& rhs) :
 			node_(std::move(rhs.node_)) {
 			rhs.node_ = nullptr;
 		}
@@ -286,6 +388,10 @@ namespace avl {
 		}
 
 		self& operator++() { /* post-increment */
+			if constexpr (Threaded) {
+				node_ = threaded_node<T>::of(node_)->next;
+				return *this;
+			}
 			if (node_->right) {
 				node_ = node_->right;
 				while (node_->left) {
@@ -303,6 +409,10 @@ namespace avl {
 		}
 
 		self& operator--() { /* pre-increment */
+			if constexpr (Threaded) {
+				node_ = threaded_node<T>::of(node_)->prev;
+				return *this;
+			}
 			if (node_->left) {
 				node_ = node_->left;
 				while (node_->right) {
@@ -331,7 +441,7 @@ namespace avl {
 			return temp;
 		}
 
-		reference operator=(const self& rhs) { node_ = rhs.node_; return *this; }
+		self& operator=(const self& rhs) { node_ = rhs.node_; return *this; }
 
 		bool operator>(const self& rhs) {
 			return **this > *rhs;
@@ -352,59 +462,209 @@ namespace avl {
 		base_ptr node_;
 	};
 
-	template<typename T>
-	class tree {
+	/*
+	 * Stats is the stats policy (avl_tree_stats.hpp). The default
+	 * no_stats costs nothing, tree_stats counts comparisons, rotations,
+	 * rebalance climbs, allocations and operation latencies.
+	 *
+	 * Threaded trees link their nodes in order (threaded_node) and keep
+	 * the first and last one, so begin(), front(), back() and every
+	 * iterator step are a single load. That costs two pointers per
+	 * node and two per tree. Bulk operations that rebuild the shape
+	 * (copies, set algebra, sorted assign and batches) relink the
+	 * threads in O(n), split and join only fix the seam.
+	 */
+	template<typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>,
+		typename Stats = no_stats, bool Threaded = false>
+	class tree : protected tree_ends<T, Threaded> {
 	public:
-		using allocator_type = std::allocator<T>;
-		using data_allocator = std::allocator<T>;
-		using node_allocator = std::allocator<tree_node<T>>;
-		using base_allocator = std::allocator<tree_node_base<T>>;
-
-		using value_type = typename allocator_type::value_type;
-		using reference = typename allocator_type::reference;
-		using pointer = typename allocator_type::pointer;
-		using const_pointer = typename allocator_type::const_pointer;
-		using const_reference = typename allocator_type::const_reference;
-		using size_type = typename allocator_type::size_type;
-		using difference_type = typename allocator_type::difference_type;
-
-		using iterator = tree_iterator<T>;
-		using const_iterator = const_tree_iterator<T>;
+		using stats_type = Stats;
+		using key_compare = Compare;
+		using value_compare = Compare;
+		using allocator_type = Allocator;
+		using alloc_traits = std::allocator_traits<Allocator>;
+		using stored_node = std::conditional_t<Threaded, threaded_node<T>, tree_node<T>>;
+		using node_allocator = typename alloc_traits::template rebind_alloc<stored_node>;
+		using node_alloc_traits = std::allocator_traits<node_allocator>;
+
+		using value_type = T;
+		using reference = T&;
+		using pointer = typename alloc_traits::pointer;
+		using const_pointer = typename alloc_traits::const_pointer;
+		using const_reference = const T&;
+		using size_type = typename alloc_traits::size_type;
+		using difference_type = typename alloc_traits::difference_type;
+
+		using iterator = tree_iterator<T, Threaded>;
+		using const_iterator = const_tree_iterator<T, Threaded>;
 		using reverse_iterator = std::reverse_iterator<iterator>;
 		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
 		using base_ptr = typename node_traits<T>::base_ptr;
 		using node_ptr = typename node_traits<T>::node_ptr;
 
-	private:
+		/*
+		 * Members and helpers are protected, map and multimap reuse the
+		 * nodes, descents and rotations of the tree (avl_map.hpp).
+		 */
+	protected:
 		base_ptr root_; /* tree root node */
 		size_t size_;   /* tree node count */
+		/* The comparator, wrapped to count its calls when Stats does. */
+		std::conditional_t<Stats::enabled, counted_compare<Compare, Stats>, Compare> comp_;
+		/*
+		 * Only the node allocator is kept. The data domain is built in
+		 * place through it, so a pmr allocator hands its resource down
+		 * to the elements (uses-allocator construction).
+		 */
 		node_allocator node_alloc_;
-		data_allocator data_alloc_;
 
 	public:
-		node_allocator get_allocator() { return node_alloc_; }
+		allocator_type get_allocator() const noexcept { return allocator_type(node_alloc_); }
+
+		key_compare key_comp() const { return comp_; }
 
-		tree() noexcept :
+		value_compare value_comp() const { return comp_; }
+
+		tree() :
 			root_(nullptr),
 			size_(0) {}
 
-		tree(const T& t) noexcept 
+		explicit tree(const Compare& comp, const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			size_(0),
+			comp_(comp),
+			node_alloc_(alloc) {}
+
+		explicit tree(const Allocator& alloc) :
+			root_(nullptr),
+			size_(0),
+			node_alloc_(alloc) {}
+
+		tree(const T& t, const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			size_(0),
+			node_alloc_(alloc)
 		{
 			root_ = create_node(t);
 			size_++;
+			rethread();
+		}
+
+		/*
+		 * Range constructors build a perfectly balanced tree in O(n)
+		 * when the input is sorted, see assign().
+		 */
+		template<typename InputIt, typename = typename
+			std::iterator_traits<InputIt>::iterator_category>
+		tree(InputIt first, InputIt last, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			size_(0),
+			comp_(comp),
+			node_alloc_(alloc)
+		{
+			assign(first, last);
+		}
+
+		template<typename InputIt, typename = typename
+			std::iterator_traits<InputIt>::iterator_category>
+		tree(InputIt first, InputIt last, const Allocator& alloc) :
+			tree(first, last, Compare(), alloc) {}
+
+		template<typename InputIt, typename = typename
+			std::iterator_traits<InputIt>::iterator_category>
+		tree(sorted_unique_t, InputIt first, InputIt last,
+			const Compare& comp = Compare(), const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			size_(0),
+			comp_(comp),
+			node_alloc_(alloc)
+		{
+			assign(sorted_unique, first, last);
+		}
+
+		tree(std::initializer_list<T> il, const Compare& comp = Compare(),
+			const Allocator& alloc = Allocator()) :
+			root_(nullptr),
+			size_(0),
+			comp_(comp),
+			node_alloc_(alloc)
+		{
+			assign(il.begin(), il.end());
 		}
 
-		tree(const tree& rhs) noexcept :
-			size_(rhs.size_) 
+		tree(std::initializer_list<T> il, const Allocator& alloc) :
+			tree(il, Compare(), alloc) {}
+
+		tree(const tree& rhs) :
+			root_(nullptr),
+			size_(rhs.size_),
+			comp_(rhs.comp_),
+			node_alloc_(node_alloc_traits::select_on_container_copy_construction(rhs.node_alloc_))
 		{
 			/* ȫһ */
-			root_ = deep_copy(rhs.root_->as_node());
+			root_ = deep_copy(rhs);
+			rethread();
+		}
+
+		tree(const tree& rhs, const Allocator& alloc) :
+			root_(nullptr),
+			size_(rhs.size_),
+			comp_(rhs.comp_),
+			node_alloc_(alloc)
+		{
+			root_ = deep_copy(rhs);
+			rethread();
 		}
 
 		tree(tree&& rhs) noexcept :
 			root_(rhs.root_),
-			size_(rhs.size_) {}
+			size_(rhs.size_),
+			comp_(rhs.comp_),
+			node_alloc_(std::move(rhs.node_alloc_))
+		{
+			take_ends(rhs);
+			rhs.root_ = nullptr;
+			rhs.size_ = 0;
+		}
+
+		tree& operator=(const tree& rhs) {
+			if (this == &rhs) return *this;
+			clear();
+			comp_ = rhs.comp_;
+			if constexpr (node_alloc_traits::propagate_on_container_copy_assignment::value) {
+				node_alloc_ = rhs.node_alloc_;
+			}
+			root_ = deep_copy(rhs);
+			size_ = rhs.size_;
+			rethread();
+			return *this;
+		}
+
+		tree& operator=(tree&& rhs) noexcept(
+			node_alloc_traits::propagate_on_container_move_assignment::value ||
+			node_alloc_traits::is_always_equal::value) {
+			if (this == &rhs) return *this;
+			clear();
+			comp_ = rhs.comp_;
+			if constexpr (node_alloc_traits::propagate_on_container_move_assignment::value) {
+				node_alloc_ = rhs.node_alloc_;
+			}
+			else if (!(node_alloc_ == rhs.node_alloc_)) {
+				/* Nodes can't change hands between unequal allocators. */
+				root_ = deep_copy(rhs);
+				size_ = rhs.size_;
+				rethread();
+				return *this;
+			}
+			root_ = rhs.root_;
+			size_ = rhs.size_;
+			take_ends(rhs);
+			rhs.root_ = nullptr;
+			rhs.size_ = 0;
+			return *this;
+		}
 
 		~tree() noexcept {
 			clear();
@@ -419,31 +679,24 @@ namespace avl {
 		}
 
 		iterator begin() noexcept {
-			auto temp = root_;
-			while (temp->left) {
-				temp = temp->left;
-			}
-			return iterator(temp);
+			return iterator(first_node());
 		}
 		
 		const_iterator begin() const noexcept {
-			const auto temp = root_;
-			while (temp->left) {
-				temp = temp->left;
-			}
-			return const_iterator(temp);
+			return const_iterator(first_node());
 		}
 
 		const_iterator cbegin() const noexcept {
 			return begin();
 		}
 
+		/* The root has no parent, so the end is always null. */
 		iterator end() noexcept {
-			return iterator(root_->parent);
+			return iterator(base_ptr(nullptr));
 		}
 
 		const_iterator end() const noexcept {
-			return const_iterator(root_->parent);
+			return const_iterator(base_ptr(nullptr));
 		}
 
 		const_iterator cend() const noexcept {
@@ -451,11 +704,7 @@ namespace avl {
 		}
 
 		reference back() {
-			const auto temp = root_;
-			while (temp->right) {
-				temp = temp->right;
-			}
-			return *temp;
+			return last_node()->as_node()->data;
 		}
 
 		bool empty() const noexcept {
@@ -464,39 +713,335 @@ namespace avl {
 
 		void clear() noexcept {
 			if (empty()) return;
+			if constexpr (is_slab_allocator<node_allocator>::value) {
+				/*
+				 * When no one else shares the pool, every block in it
+				 * belongs to this tree. Only the data domain needs to be
+				 * destroyed, then the chunks are given back at once.
+				 */
+				if (node_alloc_.exclusive()) {
+					if constexpr (!std::is_trivially_destructible<T>::value) {
+						clear_data(root_);
+					}
+					node_alloc_.release();
+					root_ = nullptr;
+					size_ = 0;
+					set_ends(nullptr, nullptr);
+					return;
+				}
+			}
 			clear_node(root_);
 			destroy_node(root_);
 			root_ = nullptr;
 			size_ = 0;
+			set_ends(nullptr, nullptr);
 		}
 
-		void swap(tree& rhs) {
+		void swap(tree& rhs) noexcept {
 			std::swap(root_, rhs.root_);
 			std::swap(size_, rhs.size_);
+			if constexpr (Threaded) {
+				std::swap(this->leftmost_, rhs.leftmost_);
+				std::swap(this->rightmost_, rhs.rightmost_);
+			}
+			using std::swap;
+			swap(comp_, rhs.comp_);
+			if constexpr (node_alloc_traits::propagate_on_container_swap::value) {
+				swap(node_alloc_, rhs.node_alloc_);
+			}
 		}
 
-		size_t size() noexcept {
+		size_t size() const noexcept {
 			return size_;
 		}
 
-		iterator insert(const T& t) {
-			if (empty()) {
-				root_ = create_node(t);
-				size_++;
-				return end();
+		/*
+		 * Replace the content with [first, last). Sorted input coming
+		 * from a forward iterator is consumed in place, anything else
+		 * is buffered, sorted and deduplicated first. The first one of
+		 * equal elements is kept, the same as repeated insert() does.
+		 */
+		template<typename InputIt>
+		void assign(InputIt first, InputIt last) {
+			using category = typename std::iterator_traits<InputIt>::iterator_category;
+			if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value) {
+				if (is_sorted_unique(first, last)) {
+					assign_sorted(first, static_cast<size_type>(std::distance(first, last)));
+					return;
+				}
+			}
+			std::vector<T> buf(first, last);
+			sort_unique(buf, [](auto b, auto e, auto less) { std::stable_sort(b, e, less); });
+			assign_sorted(std::make_move_iterator(buf.begin()), buf.size());
+		}
+
+		/* Same as above, but the buffer is sorted on the thread pool. */
+		template<typename InputIt>
+		void assign(parallel_t, InputIt first, InputIt last) {
+			std::vector<T> buf(first, last);
+			sort_unique(buf, [](auto b, auto e, auto less) {
+				parallel_stable_sort(b, e, less);
+			});
+			assign_sorted(std::make_move_iterator(buf.begin()), buf.size());
+		}
+
+		/* The caller promises [first, last) is sorted and unique. */
+		template<typename InputIt>
+		void assign(sorted_unique_t, InputIt first, InputIt last) {
+			using category = typename std::iterator_traits<InputIt>::iterator_category;
+			if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value) {
+				assign_sorted(first, static_cast<size_type>(std::distance(first, last)));
 			}
-			return iterator(insert_native(root_, t));
+			else {
+				std::vector<T> buf(first, last);
+				assign_sorted(std::make_move_iterator(buf.begin()), buf.size());
+			}
+		}
+
+		void assign(std::initializer_list<T> il) {
+			assign(il.begin(), il.end());
+		}
+
+		iterator insert(const T& t) {
+			return iterator(insert_native(t));
 		}
 
 		iterator insert(T&& t) {
-			if (empty()) {
-				root_ = create_node(t);
-				size_++;
-				return end();
+			return iterator(insert_native(std::move(t)));
+		}
+
+		template<typename ...Args>
+		iterator emplace(Args&&... args) {
+			return iterator(emplace_native(nullptr, std::forward<Args>(args)...));
+		}
+
+		/*
+		 * Insert near hint. The search starts at hint instead of root_,
+		 * so keys arriving in (nearly) sorted order, each hinted with
+		 * the previous result, cost O(1) comparisons. end() as a hint
+		 * starts from the maximum, which suits appends.
+		 */
+		template<typename ...Args>
+		iterator emplace_hint(const_iterator hint, Args&&... args) {
+			base_ptr start = hint.node_ ? hint.node_ : last_node();
+			return iterator(emplace_native(start, std::forward<Args>(args)...));
+		}
+
+		iterator insert(const_iterator hint, const T& t) {
+			return emplace_hint(hint, t);
+		}
+
+		iterator insert(const_iterator hint, T&& t) {
+			return emplace_hint(hint, std::move(t));
+		}
+
+		/*
+		 * Insert a whole batch at once and return how many elements were
+		 * new. The batch is sorted and built into a balanced tree, then
+		 * merged with union_native(): split this tree at the batch root,
+		 * merge the halves, join them back.
+		 *
+		 *      batch root k          split at k       join(l, k, r)
+		 *        /     \      =>    /         \   =>
+		 *   batch<k  batch>k   tree<k      tree>k
+		 *
+		 * Keys falling in the same subtree are carried down together
+		 * and each join rebalances only along one spine, so m keys into
+		 * n cost O(m log(n / m + 1)) instead of m descents and climbs.
+		 * Elements already here win over equal ones of the batch.
+		 */
+		template<typename InputIt>
+		size_type insert_batch(InputIt first, InputIt last) {
+			std::vector<T> buf(first, last);
+			sort_unique(buf, [](auto b, auto e, auto less) { std::stable_sort(b, e, less); });
+			return insert_sorted(std::make_move_iterator(buf.begin()), buf.size());
+		}
+
+		/* The caller promises [first, last) is sorted and unique. */
+		template<typename InputIt>
+		size_type insert_batch(sorted_unique_t, InputIt first, InputIt last) {
+			using category = typename std::iterator_traits<InputIt>::iterator_category;
+			if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value) {
+				return insert_sorted(first, static_cast<size_type>(std::distance(first, last)));
+			}
+			else {
+				std::vector<T> buf(first, last);
+				return insert_sorted(std::make_move_iterator(buf.begin()), buf.size());
 			}
-			return iterator(insert_native(root_, std::forward<T>(t)));
 		}
 
+		/*
+		 * A finger into the tree. Every operation starts searching from
+		 * the node the cursor sits on and leaves the cursor on the node
+		 * it found or inserted, so a run of nearby keys (time ordered
+		 * ids, appends, merge-like scans) costs O(1) comparisons per
+		 * key instead of a descent from root_. Erasing the node under
+		 * the cursor other than through erase() leaves it dangling, as
+		 * it does an iterator.
+		 */
+		class cursor {
+		public:
+			explicit cursor(tree& t) noexcept :
+				tree_(&t),
+				node_(nullptr) {}
+
+			cursor(tree& t, iterator it) noexcept :
+				tree_(&t),
+				node_(it.node_) {}
+
+			iterator get() const noexcept {
+				return iterator(node_);
+			}
+
+			void seek(iterator it) noexcept {
+				node_ = it.node_;
+			}
+
+			template<typename ...Args>
+			iterator emplace(Args&&... args) {
+				node_ = tree_->emplace_native(start(), std::forward<Args>(args)...);
+				return iterator(node_);
+			}
+
+			iterator insert(const T& t) {
+				return emplace(t);
+			}
+
+			iterator insert(T&& t) {
+				return emplace(std::move(t));
+			}
+
+			/* The cursor only moves when key is found. */
+			iterator find(const_reference ref) {
+				return find_native(ref);
+			}
+
+			template<typename K, typename C = Compare, typename = typename C::is_transparent>
+			iterator find(const K& key) {
+				return find_native(key);
+			}
+
+			/* Erase the node under the cursor and move to the next one. */
+			iterator erase() {
+				auto next = tree_->erase(get());
+				node_ = next.node_;
+				return next;
+			}
+
+		private:
+			base_ptr start() const noexcept {
+				return node_ ? node_ : tree_->last_node();
+			}
+
+			template<typename K>
+			iterator find_native(const K& key) {
+				base_ptr parent;
+				bool left;
+				base_ptr res = tree_->finger_locate(start(), key, parent, left);
+				if (res) {
+					node_ = res;
+				}
+				return iterator(res);
+			}
+
+			tree* tree_;
+			base_ptr node_;
+		};
+
+		/*
+		 * An owning handle to a node out of any tree, what extract()
+		 * returns and insert() takes back. The element stays where it
+		 * was built, so moving it between trees allocates nothing and
+		 * neither copies nor moves the element. The handle keeps a copy
+		 * of the node allocator, which frees the node if it never makes
+		 * it into a tree again.
+		 */
+		class node_type {
+		public:
+			using value_type = T;
+			using allocator_type = Allocator;
+
+			node_type() noexcept :
+				node_(nullptr) {}
+
+			node_type(node_type&& rhs) noexcept :
+				node_(rhs.node_),
+				alloc_(std::move(rhs.alloc_)) {
+				rhs.node_ = nullptr;
+				rhs.alloc_.reset();
+			}
+
+			node_type& operator=(node_type&& rhs) noexcept {
+				if (this != &rhs) {
+					reset();
+					node_ = rhs.node_;
+					alloc_ = std::move(rhs.alloc_);
+					rhs.node_ = nullptr;
+					rhs.alloc_.reset();
+				}
+				return *this;
+			}
+
+			~node_type() noexcept {
+				reset();
+			}
+
+			bool empty() const noexcept {
+				return node_ == nullptr;
+			}
+
+			explicit operator bool() const noexcept {
+				return node_ != nullptr;
+			}
+
+			allocator_type get_allocator() const {
+				return allocator_type(*alloc_);
+			}
+
+			value_type& value() const noexcept {
+				return node_->data;
+			}
+
+			void swap(node_type& rhs) noexcept {
+				std::swap(node_, rhs.node_);
+				std::swap(alloc_, rhs.alloc_);
+			}
+
+		private:
+			friend class tree;
+
+			node_type(node_ptr node, const node_allocator& alloc) :
+				node_(node),
+				alloc_(alloc) {}
+
+			void reset() noexcept {
+				if (node_) {
+					node_alloc_traits::destroy(*alloc_, std::addressof(node_->data));
+					node_alloc_traits::deallocate(*alloc_, static_cast<stored_node*>(node_), 1);
+					Stats::freed();
+					node_ = nullptr;
+				}
+				alloc_.reset();
+			}
+
+			node_ptr release() noexcept {
+				node_ptr res = node_;
+				node_ = nullptr;
+				alloc_.reset();
+				return res;
+			}
+
+			node_ptr node_;
+			std::optional<node_allocator> alloc_;
+		};
+
+		/* What insert(node_type&&) says, the node comes back if refused. */
+		struct insert_return_type {
+			iterator position;
+			bool inserted;
+			node_type node;
+		};
+
 		iterator erase(iterator it) {
 			auto node = it.node_->as_node();
 			auto next = ++it;
@@ -505,19 +1050,113 @@ namespace avl {
 		}
 
 		iterator find(const_reference ref) {
-			auto temp = root_;
-			while (temp) {
-				if (temp->as_node()->data == ref) {
-					return temp;
-				}
-				else if (temp->as_node()->data > ref) {
-					temp = temp->left;
-				}
-				else {
-					temp = temp->right;
-				}
-			}
-			return end();
+			return iterator(find_native(ref));
+		}
+
+		const_iterator find(const_reference ref) const {
+			return const_iterator(find_native(ref));
+		}
+
+		/*
+		 * Heterogeneous lookup, enabled by a transparent comparator like
+		 * std::less<>, e.g. a std::string_view key on a tree of strings
+		 * without building a std::string.
+		 */
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		iterator find(const K& key) {
+			return iterator(find_native(key));
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		const_iterator find(const K& key) const {
+			return const_iterator(find_native(key));
+		}
+
+		bool contains(const_reference ref) const {
+			return find_native(ref) != nullptr;
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		bool contains(const K& key) const {
+			return find_native(key) != nullptr;
+		}
+
+		size_type count(const_reference ref) const {
+			return contains(ref) ? 1 : 0;
+		}
+
+		/* The first element not less than ref. */
+		iterator lower_bound(const_reference ref) {
+			return iterator(lower_bound_native(ref));
+		}
+
+		const_iterator lower_bound(const_reference ref) const {
+			return const_iterator(lower_bound_native(ref));
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		iterator lower_bound(const K& key) {
+			return iterator(lower_bound_native(key));
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		const_iterator lower_bound(const K& key) const {
+			return const_iterator(lower_bound_native(key));
+		}
+
+		/* The first element greater than ref. */
+		iterator upper_bound(const_reference ref) {
+			return iterator(upper_bound_native(ref));
+		}
+
+		const_iterator upper_bound(const_reference ref) const {
+			return const_iterator(upper_bound_native(ref));
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		iterator upper_bound(const K& key) {
+			return iterator(upper_bound_native(key));
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		const_iterator upper_bound(const K& key) const {
+			return const_iterator(upper_bound_native(key));
+		}
+
+		std::pair<iterator, iterator> equal_range(const_reference ref) {
+			auto res = equal_range_native(ref);
+			return { iterator(res.first), iterator(res.second) };
+		}
+
+		std::pair<const_iterator, const_iterator> equal_range(const_reference ref) const {
+			auto res = equal_range_native(ref);
+			return { const_iterator(res.first), const_iterator(res.second) };
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		std::pair<iterator, iterator> equal_range(const K& key) {
+			auto res = equal_range_native(key);
+			return { iterator(res.first), iterator(res.second) };
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+			auto res = equal_range_native(key);
+			return { const_iterator(res.first), const_iterator(res.second) };
+		}
+
+		/*
+		 * Count the elements in [lo, hi) without visiting them. It is the
+		 * difference of two ranks, so it takes two descents whatever the
+		 * size of the window is.
+		 */
+		size_type count_range(const_reference lo, const_reference hi) const {
+			return count_range_native(lo, hi);
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		size_type count_range(const K& lo, const K& hi) const {
+			return count_range_native(lo, hi);
 		}
 
 		void remove(const_reference ref) {
@@ -527,6 +1166,85 @@ namespace avl {
 			}
 		}
 
+		/* Unlink the node at pos and hand it over, nothing is freed. */
+		node_type extract(const_iterator pos) {
+			base_ptr node = pos.node_;
+			unlink_native(node);
+			return node_type(node->as_node(), node_alloc_);
+		}
+
+		/* An empty handle if ref isn't here. */
+		node_type extract(const_reference ref) {
+			base_ptr node = find_native(ref);
+			return node ? extract(const_iterator(node)) : node_type();
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		node_type extract(const K& key) {
+			base_ptr node = find_native(key);
+			return node ? extract(const_iterator(node)) : node_type();
+		}
+
+		/*
+		 * Link the node of nh back in. An equal element wins, then the
+		 * handle is returned untouched in 'node'. The node is freed by
+		 * this tree's allocator one day, so both allocators must be
+		 * equal, otherwise std::invalid_argument is thrown.
+		 */
+		insert_return_type insert(node_type&& nh) {
+			if (nh.empty()) {
+				return { end(), false, node_type() };
+			}
+			base_ptr res = insert_node(nullptr, nh);
+			if (nh) {
+				return { iterator(res), false, std::move(nh) };
+			}
+			return { iterator(res), true, node_type() };
+		}
+
+		/* Same, with the search starting at hint like emplace_hint(). */
+		iterator insert(const_iterator hint, node_type&& nh) {
+			if (nh.empty()) {
+				return end();
+			}
+			return iterator(insert_node(hint.node_ ? hint.node_ : last_node(), nh));
+		}
+
+		/*
+		 * Move every node of src whose element isn't here yet, without
+		 * allocating. The ones that collide stay in src. src is walked
+		 * in order and each node searched from the last one moved, so
+		 * this side costs O(1) comparisons per node when the keys of
+		 * both trees interleave in long runs. The allocators must be
+		 * equal, or std::invalid_argument is thrown.
+		 */
+		void merge(tree& src) {
+			if (&src == this || src.empty()) return;
+			check_allocators(*this, src);
+			base_ptr finger = nullptr;
+			const_iterator it = src.begin();
+			while (it != src.end()) {
+				base_ptr node = it.node_;
+				++it;
+				base_ptr parent;
+				bool left;
+				base_ptr found = finger ? finger_locate(finger, node->as_node()->data, parent, left)
+					: locate(root_, node->as_node()->data, parent, left);
+				if (found) {
+					finger = found;
+				}
+				else {
+					src.unlink_native(node);
+					link_leaf(node, parent, left);
+					finger = node;
+				}
+			}
+		}
+
+		void merge(tree&& src) {
+			merge(src);
+		}
+
 		reference operator[](size_type i) {
 			return *(at(i));
 		}
@@ -539,37 +1257,362 @@ namespace avl {
 			if (i >= size()) {
 				throw std::out_of_range("index is out of tree[]");
 			}
-			auto it = begin();
-			size_type pos = 0;
-			while (pos++ < i) {
-				it++;
-			}
-			return it;
+			return iterator(select(i));
 		}
 
 		const_iterator at(size_type i) const {
 			if (i >= size()) {
 				throw std::out_of_range("index is out of tree[]");
 			}
-			auto it = cbegin();
-			size_type pos = 0;
-			while (pos++ < i) {
-				it++;
+			return const_iterator(select(i));
+		}
+
+		/*
+		 * Return the node at position i in ascending order, or null.
+		 * Every node knows its subtree size, so the descent compares
+		 * i with the size of the left subtree:
+		 *
+		 *          A(6)          select(4): left size of A is 3, so
+		 *         /    \         skip A and its left subtree, then go
+		 *       B(3)   C(2)      right with i = 4 - 3 - 1 = 0, and C's
+		 *       / \      \      left size is 0. The answer is C.
+		 *     D(1) E(1)  F(1)
+		 */
+		base_ptr select(size_type i) const noexcept {
+			auto node = root_;
+			while (node) {
+				size_type left = node->left ? node->left->size : 0;
+				if (i < left) {
+					node = node->left;
+				}
+				else if (i > left) {
+					i -= left + 1;
+					node = node->right;
+				}
+				else {
+					break;
+				}
 			}
-			return it;
+			return node;
 		}
 
-		template<typename U>
-		friend std::ostream& operator<<(std::ostream&, const tree<U>&);
+		/* Count the elements less than ref. */
+		size_type rank(const_reference ref) const {
+			return rank_native(ref);
+		}
+
+		template<typename K, typename C = Compare, typename = typename C::is_transparent>
+		size_type rank(const K& key) const {
+			return rank_native(key);
+		}
+
+		/*
+		 * Copy the elements into a read-only frozen_tree for lookup heavy
+		 * phases. The tree is left as it is and the snapshot doesn't see
+		 * later changes.
+		 */
+		frozen_tree<T, Compare> freeze() const {
+			return frozen_tree<T, Compare>(begin(), end(), comp_);
+		}
+
+		/*
+		 * Binary snapshots for trivially copyable T. The elements are
+		 * written in order as raw bytes after a small header:
+		 *
+		 *   | magic | version | sizeof(T) | count | checksum | T T T ... |
+		 *     4       4         4 + 4 pad   8       8          sorted
+		 *
+		 * The stream is already sorted and unique, so load() rebuilds a
+		 * perfectly balanced tree in O(n) without a comparison against
+		 * the tree or a rotation (see build_sorted()). The bytes are in
+		 * the byte order of the machine, a snapshot is meant for the
+		 * same kind of machine. A header or checksum that doesn't match
+		 * throws std::runtime_error and leaves the tree as it was.
+		 */
+		size_type serialized_size() const noexcept {
+			return sizeof(serial_header) + size_ * sizeof(T);
+		}
+
+		void save(std::ostream& os) const {
+			static_assert(std::is_trivially_copyable<T>::value, "save() needs a trivially copyable T");
+			serial_header h = make_header();
+			os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+			/* Elements go out in blocks, not one write per element. */
+			constexpr size_type block = (64 * 1024 + sizeof(T) - 1) / sizeof(T);
+			std::vector<unsigned char> buf(block * sizeof(T));
+			size_type n = 0;
+			for (auto it = begin(); it != end(); ++it) {
+				std::memcpy(buf.data() + n * sizeof(T), std::addressof(*it), sizeof(T));
+				if (++n == block) {
+					os.write(reinterpret_cast<const char*>(buf.data()), n * sizeof(T));
+					n = 0;
+				}
+			}
+			os.write(reinterpret_cast<const char*>(buf.data()), n * sizeof(T));
+			if (!os) {
+				throw std::runtime_error("tree snapshot write failed");
+			}
+		}
+
+		/* buf takes serialized_size() bytes, that many are returned. */
+		size_type save(void* buf, size_type len) const {
+			static_assert(std::is_trivially_copyable<T>::value, "save() needs a trivially copyable T");
+			if (len < serialized_size()) {
+				throw std::length_error("tree snapshot buffer is too small");
+			}
+			serial_header h = make_header();
+			auto out = static_cast<unsigned char*>(buf);
+			std::memcpy(out, &h, sizeof(h));
+			out += sizeof(h);
+			for (auto it = begin(); it != end(); ++it) {
+				std::memcpy(out, std::addressof(*it), sizeof(T));
+				out += sizeof(T);
+			}
+			return serialized_size();
+		}
+
+		void load(std::istream& is) {
+			static_assert(std::is_trivially_copyable<T>::value, "load() needs a trivially copyable T");
+			serial_header h;
+			if (!is.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+				throw std::runtime_error("tree snapshot is truncated");
+			}
+			check_header(h);
+			/*
+			 * The count is only a claim until the elements arrive. A
+			 * seekable stream is measured first, any other is read in
+			 * blocks into storage that grows with what has arrived, so
+			 * a bad count never reserves more than twice the bytes the
+			 * stream really holds.
+			 */
+			if (h.count > std::numeric_limits<size_type>::max() / sizeof(T)) {
+				throw std::runtime_error("tree snapshot is truncated");
+			}
+			size_type n = static_cast<size_type>(h.count);
+			size_type cap = n;
+			std::streampos here = is.tellg();
+			if (here != std::streampos(-1) && is.seekg(0, std::ios::end)) {
+				std::streamoff left = is.tellg() - here;
+				is.seekg(here);
+				if (left < 0 || static_cast<std::uint64_t>(left) / sizeof(T) < h.count) {
+					throw std::runtime_error("tree snapshot is truncated");
+				}
+			}
+			else {
+				is.clear();
+				cap = std::min<size_type>(n, (64 * 1024 + sizeof(T) - 1) / sizeof(T));
+			}
+			/* Read straight into storage of T, so it is aligned. */
+			std::allocator<T> alloc;
+			T* data = cap ? alloc.allocate(cap) : nullptr;
+			try {
+				size_type got = 0;
+				while (got < n) {
+					if (got == cap) {
+						size_type grown = std::min(n, cap * 2);
+						T* bigger = alloc.allocate(grown);
+						std::memcpy(static_cast<void*>(bigger), data, got * sizeof(T));
+						alloc.deallocate(data, cap);
+						data = bigger;
+						cap = grown;
+					}
+					if (!is.read(reinterpret_cast<char*>(data + got), (cap - got) * sizeof(T))) {
+						throw std::runtime_error("tree snapshot is truncated");
+					}
+					got = cap;
+				}
+				load_native(h, data, n);
+			}
+			catch (...) {
+				if (data) alloc.deallocate(data, cap);
+				throw;
+			}
+			if (data) alloc.deallocate(data, cap);
+		}
+
+		void load(const void* buf, size_type len) {
+			static_assert(std::is_trivially_copyable<T>::value, "load() needs a trivially copyable T");
+			serial_header h;
+			if (len < sizeof(h)) {
+				throw std::runtime_error("tree snapshot is truncated");
+			}
+			std::memcpy(&h, buf, sizeof(h));
+			check_header(h);
+			size_type n = static_cast<size_type>(h.count);
+			if ((len - sizeof(h)) / sizeof(T) < n) {
+				throw std::runtime_error("tree snapshot is truncated");
+			}
+			auto src = static_cast<const unsigned char*>(buf) + sizeof(h);
+			if (reinterpret_cast<std::uintptr_t>(src) % alignof(T) == 0) {
+				load_native(h, reinterpret_cast<const T*>(src), n);
+				return;
+			}
+			/* A misaligned buffer is copied out first. */
+			std::allocator<T> alloc;
+			T* data = alloc.allocate(n);
+			std::memcpy(static_cast<void*>(data), src, n * sizeof(T));
+			try {
+				load_native(h, data, n);
+			}
+			catch (...) {
+				alloc.deallocate(data, n);
+				throw;
+			}
+			alloc.deallocate(data, n);
+		}
+
+		/*
+		 * Cut the tree at key. The elements less than key stay here, the
+		 * others (key included) are moved into the returned tree. Nodes
+		 * are relinked, never copied, and it takes O(log n).
+		 */
+		tree split(const_reference key) {
+			tree res(comp_, get_allocator());
+			base_ptr left, right;
+			base_ptr found = split_native(root_, key, left, right);
+			if (found) {
+				right = join_native(nullptr, found, right);
+			}
+			root_ = left;
+			size_ = left ? left->size : 0;
+			res.root_ = right;
+			res.size_ = right ? right->size : 0;
+			if constexpr (Threaded) {
+				/* The order is the same, only cut between the halves. */
+				base_ptr lo = leftmost(right);
+				base_ptr hi = lo ? threaded_node<T>::of(lo)->prev : this->rightmost_;
+				res.set_ends(lo, lo ? this->rightmost_ : nullptr);
+				set_ends(hi ? this->leftmost_ : nullptr, hi);
+				if (lo) threaded_node<T>::of(lo)->prev = nullptr;
+				if (hi) threaded_node<T>::of(hi)->next = nullptr;
+			}
+			return res;
+		}
+
+		/*
+		 * Glue left, pivot and right into one tree in O(|h(left) -
+		 * h(right)|). Every element of left must be less than pivot and
+		 * every element of right greater than it, and both trees must
+		 * use equal allocators. Otherwise std::invalid_argument is thrown
+		 * and nothing is changed.
+		 */
+		static tree join(tree&& left, const T& pivot, tree&& right) {
+			return join_pivot(std::move(left), pivot, std::move(right));
+		}
+
+		static tree join(tree&& left, T&& pivot, tree&& right) {
+			return join_pivot(std::move(left), std::move(pivot), std::move(right));
+		}
+
+		/* Same as above without a pivot, the maximum of left is used. */
+		static tree join(tree&& left, tree&& right) {
+			check_join(left, static_cast<const T*>(nullptr), right);
+			tree res(std::move(left));
+			res.root_ = join2_native(res.root_, right.root_);
+			res.size_ += right.size_;
+			res.append_ends(right);
+			right.root_ = nullptr;
+			right.size_ = 0;
+			return res;
+		}
+
+		/*
+		 * Set algebra on two trees, in the divide and conquer style of
+		 * join based trees: take the root k of b, split a at k, solve
+		 * the two halves independently, then join the results with or
+		 * without k. For sizes m <= n the work is O(m log(n / m + 1)),
+		 * and the halves of large subproblems are forked onto the thread
+		 * pool, so the span is only polylogarithmic.
+		 *
+		 * Both trees are consumed and their nodes are reused for the
+		 * result, which keeps the elements of a when both hold equal
+		 * ones. The allocators must be equal.
+		 */
+		static tree set_union(tree&& a, tree&& b) {
+			return set_operation(std::move(a), std::move(b), &tree::union_native);
+		}
+
+		static tree set_intersection(tree&& a, tree&& b) {
+			return set_operation(std::move(a), std::move(b), &tree::intersection_native);
+		}
+
+		/* Elements of a which aren't in b. */
+		static tree set_difference(tree&& a, tree&& b) {
+			return set_operation(std::move(a), std::move(b), &tree::difference_native);
+		}
+
+		/*
+		 * Visit every element in the given order, visit(const T&). The
+		 * visitor inlines into the walk and nothing is allocated, so a
+		 * full scan is bound by memory only. A visitor returning false
+		 * stops the walk, and traverse() returns false:
+		 *
+		 *   t.traverse(avl::traverse_order::in, [&](const T& v) {
+		 *       return v < limit;  // stop at the first one past limit
+		 *   });
+		 */
+		template<typename Visit>
+		bool traverse(traverse_order order, Visit&& visit) const {
+			return traversal<tree_node_base<T>>::walk(order, root_, [&visit](base_ptr node) {
+				return visit(static_cast<const T&>(node->as_node()->data));
+			});
+		}
+
+		/*
+		 * Whole-tree scans on the thread pool. The tree is cut at
+		 * subtree roots until the pieces hold parallel_grain nodes, each
+		 * piece is walked in order on one thread, and idle threads steal
+		 * the pieces still queued:
+		 *
+		 *            r            fork: left | r, right
+		 *          /   \          again below while a subtree is
+		 *       [ L ]  [ R ]      larger than parallel_grain
+		 *
+		 * f, reduce, map and pred run on several threads at once and
+		 * must not change the tree. The tree must not change during the
+		 * scan either.
+		 */
+		template<typename F>
+		void parallel_for_each(const F& f) const {
+			for_each_native(root_, f);
+		}
+
+		/*
+		 * Fold map(element) with reduce, which must be associative. The
+		 * elements are combined in order, so reduce needn't commute,
+		 * and init is combined once, on the left.
+		 */
+		template<typename U, typename Reduce, typename Map>
+		U parallel_reduce(U init, const Reduce& reduce, const Map& map) const {
+			std::optional<U> res = reduce_native<U>(root_, reduce, map);
+			return res ? reduce(std::move(init), std::move(*res)) : init;
+		}
+
+		template<typename U, typename Reduce>
+		U parallel_reduce(U init, const Reduce& reduce) const {
+			return parallel_reduce(std::move(init), reduce, [](const T& v) -> const T& { return v; });
+		}
+
+		template<typename Pred>
+		size_type parallel_count_if(const Pred& pred) const {
+			return parallel_reduce(size_type(0), std::plus<size_type>(),
+				[&pred](const T& v) -> size_type { return pred(v) ? 1 : 0; });
+		}
+
+		template<typename U, typename C, typename A, typename S, bool H>
+		friend std::ostream& operator<<(std::ostream&, tree<U, C, A, S, H>&);
 
 #ifdef DEBUG_OUTPUT
-		void debug_traverse(DEBUG_OUTPUT_METHOD method, std::function<void(base_ptr)> func) {
+		/* Depth first search is the pre-order walk. */
+		template<typename Visit>
+		void debug_traverse(DEBUG_OUTPUT_METHOD method, Visit&& func) {
 			switch (method)
 			{
 			case avl::DEBUG_OUTPUT_METHOD::INORDER:
 				in_order_traverse(root_, func);
 				break;
 			case avl::DEBUG_OUTPUT_METHOD::PREORDER:
+			case avl::DEBUG_OUTPUT_METHOD::DFSEARCH:
 				pre_order_traverse(root_, func);
 				break;
 			case avl::DEBUG_OUTPUT_METHOD::POSTORDER:
@@ -578,36 +1621,45 @@ namespace avl {
 			case avl::DEBUG_OUTPUT_METHOD::LEVELORDER:
 				level_order_traverse(root_, func);
 				break;
-			case avl::DEBUG_OUTPUT_METHOD::DFSEARCH:
-				depth_first_search_traverse(root_, func);
-				break;
 			default:
 				break;
 			}
 		}
 #endif // DEBUG_OUTPUT
 
-	private:
-		void tree_rebalance(base_ptr node) { 
+	protected:
+		void tree_rebalance(base_ptr node) {
+			tree_rebalance(node, root_);
+		}
+
+		/*
+		 * The rotations replace the top of the tree whenever the rotated
+		 * node has no parent, so the root to update is passed in. That
+		 * lets detached subtrees be rebalanced (join, split) without
+		 * touching root_, also from several threads.
+		 */
+		static void tree_rebalance(base_ptr node, base_ptr& root) {
+			unsigned climbed = 0;
 			while (1) {
 				if (!node) {
 					break; /* Null means this node is root_'s parent. */
 				}
+				climbed++;
 				int delta = get_balanced_factor(node);
 				if (delta > 1) {
 					if (get_balanced_factor(node->left) >= 0) {
-						node = ll_rotate(node);
+						node = ll_rotate(node, root);
 					}
 					else {
-						node = lr_rotate(node);
+						node = lr_rotate(node, root);
 					}
 				}
 				else if (delta < -1) {
 					if (get_balanced_factor(node->right) <= 0) {
-						node = rr_rotate(node);
+						node = rr_rotate(node, root);
 					}
 					else {
-						node = rl_rotate(node);
+						node = rl_rotate(node, root);
 					}
 				}
 				else {
@@ -619,90 +1671,352 @@ namespace avl {
 				}
 				node = node->parent;
 			}
+			Stats::rebalanced(climbed);
 		}
 
-		node_ptr insert_native(node_ptr node, const T& t) {
-			iterator res;
-			while (1) {
-				if (node->data < t) {
-					if (node->right) {
-						node = node->right;
-					}
-					else {
-						node->right = create_node(t);
-						node->right->parent = node;
-						res = node->right;
-						break;
-					}
+		/*
+		 * Compare a stored value with a key: negative, zero or positive
+		 * like '<=>'. It costs one '<=>' when the comparator allows it,
+		 * otherwise one or two calls of the comparator.
+		 */
+		template<typename K>
+		int compare3(const T& data, const K& key) const {
+#if defined(__cpp_lib_three_way_comparison) && defined(__cpp_lib_concepts)
+			if constexpr (three_way_less<Compare, T, K>::value) {
+				Stats::compared();
+				auto res = data <=> key;
+				return res < 0 ? -1 : (res > 0 ? 1 : 0);
+			}
+			else
+#endif
+			{
+				return comp_(data, key) ? -1 : (comp_(key, data) ? 1 : 0);
+			}
+		}
 
+		/*
+		 * Descend from node for key with one comparison per level. Return
+		 * the node equal to key, or null with 'parent' and 'left' telling
+		 * where a new leaf for key would hang. The subtree of node must
+		 * cover key, which is always true for root_.
+		 *
+		 * Without '<=>' the descent only asks 'key < data'. When it goes
+		 * right, data <= key, so the last node where it went right is the
+		 * greatest one not above key. Key is present only if that node
+		 * isn't less than key, which is checked once at the bottom:
+		 *
+		 *          5          locate(6):
+		 *         / \          6 < 5? no, go right, cand = 5
+		 *        3   7         6 < 7? yes, go left
+		 *           / \        6 < 6? no, go right, cand = 6
+		 *          6   9       bottom: 6 < 6 is false, so cand == key.
+		 */
+		template<typename K>
+		base_ptr locate(base_ptr node, const K& key, base_ptr& parent, bool& left) const {
+			parent = node ? node->parent : nullptr;
+			left = false;
+#if defined(__cpp_lib_three_way_comparison) && defined(__cpp_lib_concepts)
+			if constexpr (three_way_less<Compare, T, K>::value) {
+				while (node) {
+					Stats::compared();
+					auto res = node->as_node()->data <=> key;
+					if (res == 0) {
+						return node;
+					}
+					parent = node;
+					left = res > 0;
+					node = left ? node->left : node->right;
 				}
-				else if (node->data > t) {
-					if (node->left) {
+				return nullptr;
+			}
+			else
+#endif
+			{
+				base_ptr cand = nullptr;
+				while (node) {
+					parent = node;
+					left = comp_(key, node->as_node()->data);
+					if (left) {
 						node = node->left;
 					}
-					else{
-						node->left = create_node(t);
-						node->left->parent = node;
-						res = node->left;
-						break;
+					else {
+						cand = node;
+						node = node->right;
 					}
 				}
+				return cand && !comp_(cand->as_node()->data, key) ? cand : nullptr;
+			}
+		}
+
+		template<typename K>
+		base_ptr find_native(const K& key) const {
+			typename Stats::timer timer(tree_op::find);
+			base_ptr parent;
+			bool left;
+			return locate(root_, key, parent, left);
+		}
+
+		/*
+		 * One comparison per level: everything passed on the way down to
+		 * the left is a candidate, the last one is the lowest of them.
+		 */
+		template<typename K>
+		base_ptr lower_bound_native(const K& key) const {
+			base_ptr res = nullptr;
+			auto node = root_;
+			while (node) {
+				if (comp_(node->as_node()->data, key)) {
+					node = node->right;
+				}
 				else {
-					return node;
+					res = node;
+					node = node->left;
 				}
 			}
+			return res;
+		}
 
-			tree_rebalance(node);
-			size_++;
+		template<typename K>
+		base_ptr upper_bound_native(const K& key) const {
+			base_ptr res = nullptr;
+			auto node = root_;
+			while (node) {
+				if (comp_(key, node->as_node()->data)) {
+					res = node;
+					node = node->left;
+				}
+				else {
+					node = node->right;
+				}
+			}
 			return res;
 		}
 
-		base_ptr insert_native(base_ptr node, T&& t) {
-			base_ptr res;
-			while (1) {
-				if (node->as_node()->data < t) {
-					if (node->right) {
-						node = node->right;
+		/* Keys are unique, so the range holds at most lower_bound. */
+		template<typename K>
+		std::pair<base_ptr, base_ptr> equal_range_native(const K& key) const {
+			base_ptr lo = lower_bound_native(key);
+			if (!lo || comp_(key, lo->as_node()->data)) {
+				return { lo, lo };
+			}
+			const_iterator hi(lo);
+			++hi;
+			return { lo, hi.node_ };
+		}
+
+		template<typename K>
+		size_type count_range_native(const K& lo, const K& hi) const {
+			if (!comp_(lo, hi)) {
+				return 0;
+			}
+			return rank_native(hi) - rank_native(lo);
+		}
+
+		template<typename K>
+		size_type rank_native(const K& key) const {
+			size_type res = 0;
+			auto node = root_;
+			while (node) {
+				if (comp_(node->as_node()->data, key)) {
+					res += 1 + (node->left ? node->left->size : 0);
+					node = node->right;
+				}
+				else {
+					node = node->left;
+				}
+			}
+			return res;
+		}
+
+		/*
+		 * Both lvalue and rvalue insertions come here, the value is
+		 * only forwarded into the new leaf.
+		 */
+		template<typename V>
+		base_ptr insert_native(V&& t) {
+			typename Stats::timer timer(tree_op::insert);
+			base_ptr parent;
+			bool left;
+			if (auto found = locate(root_, t, parent, left)) {
+				return found;
+			}
+			base_ptr res = create_node(std::forward<V>(t));
+			link_leaf(res, parent, left);
+			return res;
+		}
+
+		/*
+		 * Build the value first, then search for it from 'start', which
+		 * is a finger search when start isn't null. An equal element
+		 * wins and the new node is dropped again.
+		 */
+		template<typename ...Args>
+		base_ptr emplace_native(base_ptr start, Args&&... args) {
+			typename Stats::timer timer(tree_op::insert);
+			node_ptr node = create_node(std::forward<Args>(args)...);
+			base_ptr parent;
+			bool left;
+			base_ptr found;
+			try {
+				found = start ? finger_locate(start, node->data, parent, left)
+					: locate(root_, node->data, parent, left);
+			}
+			catch (...) {
+				destroy_node(node);
+				throw;
+			}
+			if (found) {
+				destroy_node(node);
+				return found;
+			}
+			link_leaf(node, parent, left);
+			return node;
+		}
+
+		/* Hang a new leaf where locate() said and rebalance. */
+		void link_leaf(base_ptr node, base_ptr parent, bool left) {
+			if constexpr (Threaded) {
+				thread_leaf(node, parent, left);
+			}
+			node->parent = parent;
+			if (!parent) {
+				root_ = node;
+			}
+			else if (left) {
+				parent->left = node;
+			}
+			else {
+				parent->right = node;
+			}
+
+			/*
+			 * tree_rebalance() may stop halfway when a height doesn't
+			 * change, but every ancestor gains one node.
+			 */
+			for (auto temp = parent; temp; temp = temp->parent) {
+				temp->size++;
+			}
+			tree_rebalance(parent);
+			size_++;
+		}
+
+		/*
+		 * Finger search: look for key starting at the node 'hint' and
+		 * walk outward through the parent links, then descend. Say key
+		 * is above hint. If hint has no right child, its successor is
+		 * the first ancestor reached from the left, so one comparison
+		 * tells whether key goes right below hint:
+		 *
+		 *            S            key > h, h->right is null:
+		 *           /             climb right links up to S without
+		 *          A              comparing. If S is missing, h is the
+		 *           \             maximum, key hangs at h->right. If
+		 *            h            key < S, same. Otherwise go on.
+		 *
+		 * Otherwise climb until an ancestor reached from the left is
+		 * above key. Its left subtree covers key, descend from there.
+		 * Both climbs and descent are O(log d) comparisons, where d is
+		 * the distance between hint and key, so sequential keys take
+		 * O(1) comparisons each. A null hint means the maximum.
+		 */
+		template<typename K>
+		base_ptr finger_locate(base_ptr hint, const K& key, base_ptr& parent, bool& left) const {
+			if (!hint) {
+				hint = last_node();
+			}
+			if (!hint) {
+				parent = nullptr;
+				left = false;
+				return nullptr;
+			}
+			int res = compare3(hint->as_node()->data, key);
+			if (res == 0) {
+				return hint;
+			}
+			base_ptr node = hint;
+			if (res < 0) {
+				if (!node->right) {
+					while (node->parent && node->parent->right == node) {
+						node = node->parent;
 					}
-					else {
-						node->right = create_node(std::forward<T>(t));
-						node->right->parent = node;
-						res = node->right;
-						break;
+					base_ptr succ = node->parent;
+					int c = succ ? compare3(succ->as_node()->data, key) : 1;
+					if (c == 0) {
+						return succ;
 					}
-
+					if (c > 0) {
+						parent = hint;
+						left = false;
+						return nullptr;
+					}
+					node = succ;
 				}
-				else if (node->as_node()->data > t) {
-					if (node->left) {
-						node = node->left;
+				while (node->parent) {
+					base_ptr p = node->parent;
+					if (p->left == node) {
+						int c = compare3(p->as_node()->data, key);
+						if (c == 0) return p;
+						if (c > 0) break;
 					}
-					else {
-						node->left = create_node(std::forward<T>(t));
-						node->left->parent = node;
-						res = node->left;
-						break;
+					node = p;
+				}
+			}
+			else {
+				if (!node->left) {
+					while (node->parent && node->parent->left == node) {
+						node = node->parent;
+					}
+					base_ptr pred = node->parent;
+					int c = pred ? compare3(pred->as_node()->data, key) : -1;
+					if (c == 0) {
+						return pred;
 					}
+					if (c < 0) {
+						parent = hint;
+						left = true;
+						return nullptr;
+					}
+					node = pred;
 				}
-				else {
-					return node;
+				while (node->parent) {
+					base_ptr p = node->parent;
+					if (p->right == node) {
+						int c = compare3(p->as_node()->data, key);
+						if (c == 0) return p;
+						if (c < 0) break;
+					}
+					node = p;
 				}
 			}
-
-			tree_rebalance(node);
-			size_++;
-			return res;
+			return locate(node, key, parent, left);
 		}
 
 		void erase_native(base_ptr node) {
+			typename Stats::timer timer(tree_op::erase);
+			unlink_native(node);
+			destroy_node(node);
+		}
+
+		/*
+		 * Take node out of the tree and rebalance, but keep it alive. It
+		 * leaves as a single fresh leaf, ready for link_leaf() anywhere.
+		 */
+		void unlink_native(base_ptr node) {
+			base_ptr pred = nullptr;
+			if constexpr (Threaded) {
+				pred = unthread(node);
+			}
 			base_ptr unbalanced_node;
 			if (!node->left) {
 				unbalanced_node = node->parent;
 				reconnect_parent_with_new_child(node->right, node);
-				destroy_node(node);
+				if (node == root_) {
+					root_ = node->right;
+				}
 			}
 			else {
-				/* Find precessor node */
-				auto temp = node->left;
+				/* Find precessor node, a threaded tree knows it. */
+				auto temp = pred ? pred : node->left;
 				while (temp->right) {
 					temp = temp->right;
 				}
@@ -720,12 +2034,14 @@ namespace avl {
 #else
 				/* 
 				 * If temp isn't the left child of node, reconnect temp's
-				 * parent with its left child. Otherwise, it means node
-				 * is the parent of temp. So unbalanced state starts from
-				 * itself.
+				 * parent with its left child and let temp adopt node's
+				 * left subtree. Otherwise, it means node is the parent
+				 * of temp. So unbalanced state starts from itself.
 				 */
 				if (temp->parent != node) {
 					reconnect_parent_with_new_child(temp->left, temp);
+					temp->left = node->left;
+					temp->left->parent = temp;
 				}
 				else {
 					unbalanced_node = temp;
@@ -735,22 +2051,57 @@ namespace avl {
 					node->right->parent = temp;
 				}
 				temp->right = node->right;
+				/*
+				 * temp takes node's place, so it also takes its height,
+				 * otherwise tree_rebalance() may stop below it.
+				 */
+				temp->height = node->height;
 				/* Set node's parent as temp's parent. */
 				reconnect_parent_with_new_child(temp, node);
-				destroy_node(node);
+				if (node == root_) {
+					root_ = temp;
+				}
 #endif
 			}
 
+			/* Every node from the unlinked position up loses one node. */
+			for (auto temp = unbalanced_node; temp; temp = temp->parent) {
+				temp->update_size();
+			}
 			tree_rebalance(unbalanced_node);
 			size_--;
-			return;
+			node->left = nullptr;
+			node->right = nullptr;
+			node->parent = nullptr;
+			node->height = 1;
+			node->size = 1;
+		}
+
+		/*
+		 * Link the node held by nh from start (a finger search) or from
+		 * root_. The handle lets go of it only when it is linked, else
+		 * the equal element is returned and nh still owns its node.
+		 */
+		base_ptr insert_node(base_ptr start, node_type& nh) {
+			if (!(*nh.alloc_ == node_alloc_)) {
+				throw std::invalid_argument("nodes can't move between unequal allocators");
+			}
+			base_ptr parent;
+			bool left;
+			const T& data = nh.node_->data;
+			base_ptr found = start ? finger_locate(start, data, parent, left)
+				: locate(root_, data, parent, left);
+			if (found) return found;
+			base_ptr node = nh.release();
+			link_leaf(node, parent, left);
+			return node;
 		}
 
 		/*
 		 * This function reconnect node2's parent with node1 as new 
 		 * child. 
 		 */
-		void reconnect_parent_with_new_child(base_ptr node1, base_ptr node2) {
+		static void reconnect_parent_with_new_child(base_ptr node1, base_ptr node2) {
 			if (node2->parent) {
 				if (node2->parent->left == node2) {
 					node2->parent->left = node1;
@@ -764,7 +2115,8 @@ namespace avl {
 			}
 		}
 
-		base_ptr ll_rotate(base_ptr node) {
+		static base_ptr ll_rotate(base_ptr node, base_ptr& root) {
+			Stats::rotated(rotation::ll);
 			/* Change child's relationship */
 			auto temp = node->left;
 			node->left = temp->right;
@@ -780,12 +2132,13 @@ namespace avl {
 			temp->update_height();
 			/* Update root node */
 			if (!temp->parent) {
-				root_ = temp;
+				root = temp;
 			}
 			return temp;
 		}
 
-		base_ptr rr_rotate(base_ptr node) {
+		static base_ptr rr_rotate(base_ptr node, base_ptr& root) {
+			Stats::rotated(rotation::rr);
 			/* Change child's relationship */
 			auto temp = node->right;
 			node->right = temp->left;
@@ -801,263 +2154,974 @@ namespace avl {
 			temp->update_height();
 			/* Update root node */
 			if (!temp->parent) {
-				root_ = temp;
+				root = temp;
 			}
 			return temp;
 		}
 
-		base_ptr lr_rotate(base_ptr node) {
-			node->left = rr_rotate(node->left);
-			node = ll_rotate(node);
+		static base_ptr lr_rotate(base_ptr node, base_ptr& root) {
+			Stats::rotated(rotation::lr);
+			node->left = rr_rotate(node->left, root);
+			node = ll_rotate(node, root);
 			return node;
 		}
 
-		base_ptr rl_rotate(base_ptr node) {
-			node->right = ll_rotate(node->right);
-			node = rr_rotate(node);
+		static base_ptr rl_rotate(base_ptr node, base_ptr& root) {
+			Stats::rotated(rotation::rl);
+			node->right = ll_rotate(node->right, root);
+			node = rr_rotate(node, root);
 			return node;
 		}
 
-		int get_height(base_ptr node) {
+		static int get_height(base_ptr node) {
 			return node ? node->height : 0;
 		}
 
-		int get_balanced_factor(base_ptr node) {
+		static int get_balanced_factor(base_ptr node) {
 			return node ? get_height(node->left) - get_height(node->right) : 0;
 		}
 
-		template<typename ...Args>
-		node_ptr create_node(Args&&... args) {
-			auto temp = node_alloc_.allocate(1);
-			try {
-				data_alloc_.construct(std::addressof(temp->data), std::forward<Args>(args)...);
-				temp->as_base()->height = 1;
-				temp->as_base()->left = nullptr;
-				temp->as_base()->right = nullptr;
-				temp->as_base()->parent = nullptr;
+		base_ptr first_node() const noexcept {
+			if constexpr (Threaded) {
+				return this->leftmost_;
 			}
-			catch (...) {
-				node_alloc_.deallocate(temp, 1);
-				throw;
+			else {
+				return leftmost(root_);
 			}
-			return temp;
 		}
 
-		node_ptr deep_copy(const node_ptr root) {
-			if (!root) return root;
-			auto temp = create_node(root->data);
-			temp->height = root->height;
-			if (root->left) {
-				temp->left = deep_copy(root->left);
-				temp->left->parent = temp;
+		base_ptr last_node() const noexcept {
+			if constexpr (Threaded) {
+				return this->rightmost_;
 			}
-			if (root->right) {
-				temp->right = deep_copy(root->right);
-				temp->right->parent = temp;
+			else {
+				return rightmost(root_);
 			}
-			return temp;
 		}
 
-		void destroy_node(base_ptr node) {
-			data_alloc_.destroy(&node->as_node()->data);
-			node_alloc_.deallocate(node->as_node(), 1);
+		/* The thread helpers below do nothing unless Threaded. */
+		void set_ends(base_ptr first, base_ptr last) noexcept {
+			if constexpr (Threaded) {
+				this->leftmost_ = first;
+				this->rightmost_ = last;
+			}
 		}
 
-		void clear_node(base_ptr node) noexcept {
-			if (node->left) {
-				clear_node(node->left);
-				destroy_node(node->left);
-			}
-			
-			if (node->right) {
-				clear_node(node->right);
-				destroy_node(node->right);
+		void take_ends(tree& rhs) noexcept {
+			if constexpr (Threaded) {
+				set_ends(rhs.leftmost_, rhs.rightmost_);
+				rhs.set_ends(nullptr, nullptr);
 			}
 		}
 
-#ifdef DEBUG_OUTPUT
-	public:
-		void pre_order_traverse(base_ptr root,
-			std::function<void(base_ptr)> func) {
-#ifdef DEBUG_RECURISE_MODE
-			if (!root) return;
-			func(root);
-			pre_order_traverse(root->left, func);
-			pre_order_traverse(root->right, func);
-#else
-			auto node = root;
-			std::stack<base_ptr> stk;
-			while (node || !stk.empty()) {
-				if (node) {
-					func(node);
-					stk.push(node);
-					node = node->left;
+		/* rhs followed this tree in order and its nodes joined it. */
+		void append_ends(tree& rhs) noexcept {
+			if constexpr (Threaded) {
+				if (!rhs.leftmost_) return;
+				if (this->rightmost_) {
+					threaded_node<T>::of(this->rightmost_)->next = rhs.leftmost_;
+					threaded_node<T>::of(rhs.leftmost_)->prev = this->rightmost_;
 				}
 				else {
-					auto temp = stk.top();
-					stk.pop();
-					node = temp->right;
+					this->leftmost_ = rhs.leftmost_;
 				}
+				this->rightmost_ = rhs.rightmost_;
+				rhs.set_ends(nullptr, nullptr);
 			}
-#endif // DEBUG_RECURISE_MODE
 		}
 
-		void in_order_traverse(base_ptr root,
-			std::function<void(base_ptr)> func) {
-#ifdef DEBUG_RECURISE_MODE
-			if (!root) return;
-			in_order_traverse(root->left, func);
-			func(root);
-			in_order_traverse(root->right, func);
-#else
-			auto node = root;
-			std::stack<base_ptr> stk;
-			while (node || !stk.empty()) {
-				if (node) {
-					stk.push(node);
-					node = node->left;
-				}
-				else {
-					auto temp = stk.top();
-					stk.pop();
-					/* 
-					 * After all left nodes are in the stack, then turn to
-					 * pop the stack. In this way, the pop order will be 
-					 * left, root and right.
-					 */
-					func(temp);
-					node = temp->right;
+		/* Link every node to its neighbours again, O(n). */
+		void rethread() noexcept {
+			if constexpr (Threaded) {
+				base_ptr prev = nullptr;
+				traversal<tree_node_base<T>>::in_order(root_, [&prev](base_ptr node) {
+					threaded_node<T>::of(node)->prev = prev;
+					if (prev) threaded_node<T>::of(prev)->next = node;
+					prev = node;
+				});
+				if (prev) threaded_node<T>::of(prev)->next = nullptr;
+				set_ends(leftmost(root_), prev);
+			}
+		}
+
+		/*
+		 * A leaf hung left of parent comes right before it, one hung
+		 * right comes right after it.
+		 */
+		void thread_leaf(base_ptr node, base_ptr parent, bool left) noexcept {
+			auto n = threaded_node<T>::of(node);
+			if (!parent) {
+				n->prev = n->next = nullptr;
+			}
+			else if (left) {
+				n->next = parent;
+				n->prev = threaded_node<T>::of(parent)->prev;
+			}
+			else {
+				n->prev = parent;
+				n->next = threaded_node<T>::of(parent)->next;
+			}
+			if (n->prev) threaded_node<T>::of(n->prev)->next = node;
+			else this->leftmost_ = node;
+			if (n->next) threaded_node<T>::of(n->next)->prev = node;
+			else this->rightmost_ = node;
+		}
+
+		/* Take node out of the order and return its predecessor. */
+		base_ptr unthread(base_ptr node) noexcept {
+			auto n = threaded_node<T>::of(node);
+			base_ptr prev = n->prev;
+			if (n->prev) threaded_node<T>::of(n->prev)->next = n->next;
+			else this->leftmost_ = n->next;
+			if (n->next) threaded_node<T>::of(n->next)->prev = n->prev;
+			else this->rightmost_ = n->prev;
+			n->prev = n->next = nullptr;
+			return prev;
+		}
+
+		static base_ptr leftmost(base_ptr node) noexcept {
+			while (node && node->left) {
+				node = node->left;
+			}
+			return node;
+		}
+
+		static base_ptr rightmost(base_ptr node) noexcept {
+			while (node && node->right) {
+				node = node->right;
+			}
+			return node;
+		}
+
+		template<typename V>
+		static tree join_pivot(tree&& left, V&& pivot, tree&& right) {
+			check_join(left, &pivot, right);
+			tree res(std::move(left));
+			base_ptr mid = res.create_node(std::forward<V>(pivot));
+			res.root_ = join_native(res.root_, mid, right.root_);
+			res.size_ += right.size_ + 1;
+			if constexpr (Threaded) {
+				/* mid goes last, then right is appended. */
+				threaded_node<T>::of(mid)->prev = res.rightmost_;
+				if (res.rightmost_) threaded_node<T>::of(res.rightmost_)->next = mid;
+				else res.leftmost_ = mid;
+				res.rightmost_ = mid;
+			}
+			res.append_ends(right);
+			right.root_ = nullptr;
+			right.size_ = 0;
+			return res;
+		}
+
+		static void check_allocators(const tree& left, const tree& right) {
+			if (!(left.node_alloc_ == right.node_alloc_)) {
+				throw std::invalid_argument("nodes can't move between unequal allocators");
+			}
+		}
+
+		static void check_join(const tree& left, const T* pivot, const tree& right) {
+			check_allocators(left, right);
+			auto max = rightmost(left.root_);
+			auto min = leftmost(right.root_);
+			auto& comp = left.comp_;
+			if (pivot) {
+				if ((max && !comp(max->as_node()->data, *pivot)) ||
+					(min && !comp(*pivot, min->as_node()->data))) {
+					throw std::invalid_argument("join pivot is out of order");
 				}
 			}
-#endif // DEBUG_RECURISE_MODE
+			else if (max && min && !comp(max->as_node()->data, min->as_node()->data)) {
+				throw std::invalid_argument("joined trees overlap");
+			}
 		}
 
-		void post_order_traverse(base_ptr root,
-			std::function<void(base_ptr)> func) {
-#ifdef DEBUG_RECURISE_MODE
-			if (!root) return;
-			in_order_traverse(root->left, func);
-			in_order_traverse(root->right, func);
-			func(root);
-#else
-			/*
-			 * In post-order traversal, it's impossible to try method like
-			 * the above, due to the root and left nodes' pushed order. Only
-			 * firstly all nodes are pushed into the stack, then pop them 
-			 * one-by-one.
-			 */
-			auto node = root;
-			std::stack<base_ptr> in;
-			std::stack<base_ptr> out;
-			while (node || !in.empty()) {
-				if (node) {
-					in.push(node);
-					out.push(node);
-					node = node->right;
+		/*
+		 * Join two detached subtrees with the detached node mid, where
+		 * left < mid < right. When the heights are close, mid simply
+		 * becomes the root. Otherwise walk down the spine of the higher
+		 * tree facing the lower one, until a node c is no more than one
+		 * level higher than the lower tree, and put mid in its place:
+		 *
+		 *          A                          A
+		 *         / \                        / \
+		 *        B   C      join(A, m, R)    B   C
+		 *           / \    ============>       / \
+		 *          D   c                      D   m
+		 *                                        / \
+		 *                                       c   R
+		 *
+		 * Then only the path above mid can be out of balance, which is
+		 * what tree_rebalance() repairs. Subtree sizes are fixed along
+		 * the whole path because rebalance may stop early. The root of
+		 * the joined tree is returned.
+		 */
+		static base_ptr join_native(base_ptr left, base_ptr mid, base_ptr right) {
+			int hl = get_height(left);
+			int hr = get_height(right);
+			if (hl > hr + 1 || hr > hl + 1) {
+				bool down_right = hl > hr;
+				base_ptr top = down_right ? left : right;
+				int low = down_right ? hr : hl;
+				base_ptr parent = nullptr;
+				base_ptr node = top;
+				while (get_height(node) > low + 1) {
+					parent = node;
+					node = down_right ? node->right : node->left;
+				}
+				if (down_right) {
+					mid->left = node;
+					mid->right = right;
+					parent->right = mid;
 				}
 				else {
-					auto temp = in.top();
-					in.pop();
-					node = temp->left;
+					mid->left = left;
+					mid->right = node;
+					parent->left = mid;
 				}
+				if (mid->left) mid->left->parent = mid;
+				if (mid->right) mid->right->parent = mid;
+				mid->parent = parent;
+				mid->update_height();
+				top->parent = nullptr;
+				for (auto temp = parent; temp; temp = temp->parent) {
+					temp->update_size();
+				}
+				tree_rebalance(parent, top);
+				return top;
 			}
-			/* The nodes in this stack is in root-right-left order. Then
-			 * pop order is in left-right-root.
-			 */
-			while (!out.empty()) {
-				auto temp = out.top();
-				func(temp);
-				out.pop();
+			mid->left = left;
+			mid->right = right;
+			if (left) left->parent = mid;
+			if (right) right->parent = mid;
+			mid->parent = nullptr;
+			mid->update_height();
+			return mid;
+		}
+
+		/* Join two detached subtrees with left < right and no pivot. */
+		static base_ptr join2_native(base_ptr left, base_ptr right) {
+			if (!left) return right;
+			if (!right) return left;
+			base_ptr max;
+			base_ptr rest = split_last(left, max);
+			return join_native(rest, max, right);
+		}
+
+		/* Detach the maximum node of a detached subtree. */
+		static base_ptr split_last(base_ptr node, base_ptr& max) {
+			base_ptr left = node->left;
+			base_ptr right = node->right;
+			if (left) left->parent = nullptr;
+			if (!right) {
+				max = node;
+				return left;
 			}
+			right->parent = nullptr;
+			base_ptr rest = split_last(right, max);
+			return join_native(left, node, rest);
+		}
 
-#if 0
-			auto node = root;
-			base_ptr prev;
-			std::stack<base_ptr> stk;
-			while (node || !stk.empty()) {
-				if (node) {
-					stk.push(node);
-					node = node->left;
-				}
-				else {
-					auto temp = stk.top();
-					stk.pop();
-					/* If the node is the right node's parent */
-					if (!temp->right || prev == temp->right) {
-						func(temp);
-						perv = temp;
-						temp = nullptr;
+		/* Take the children off a node of a detached subtree. */
+		static void expose(base_ptr node, base_ptr& left, base_ptr& right) noexcept {
+			left = node->left;
+			right = node->right;
+			if (left) left->parent = nullptr;
+			if (right) right->parent = nullptr;
+			node->left = node->right = nullptr;
+		}
+
+		/*
+		 * Split a detached subtree into the nodes less than key and the
+		 * nodes greater than it. The node equal to key, if any, is
+		 * returned detached. Every level joins its leftovers back on one
+		 * side, and the joins cost the height differences, which add up
+		 * to O(log n) over the whole descent.
+		 */
+		base_ptr split_native(base_ptr node, const_reference key, base_ptr& left, base_ptr& right) const {
+			if (!node) {
+				left = right = nullptr;
+				return nullptr;
+			}
+			base_ptr l, r, found;
+			expose(node, l, r);
+			int res = compare3(node->as_node()->data, key);
+			if (res < 0) {
+				base_ptr rl;
+				found = split_native(r, key, rl, right);
+				left = join_native(l, node, rl);
+			}
+			else if (res > 0) {
+				base_ptr lr;
+				found = split_native(l, key, left, lr);
+				right = join_native(lr, node, r);
+			}
+			else {
+				left = l;
+				right = r;
+				found = node;
+			}
+			return found;
+		}
+
+		/*
+		 * Nodes dropped by the set operations. They are chained through
+		 * their parent links while the recursion runs, possibly on many
+		 * threads, and given back to the allocator afterwards on one
+		 * thread, as allocators are not required to be thread-safe.
+		 */
+		struct node_list {
+			base_ptr head = nullptr;
+			base_ptr tail = nullptr;
+
+			void push(base_ptr node) noexcept {
+				if (!node) return;
+				node->parent = head;
+				if (!head) tail = node;
+				head = node;
+			}
+
+			void splice(node_list& rhs) noexcept {
+				if (!rhs.head) return;
+				rhs.tail->parent = head;
+				if (!head) tail = rhs.tail;
+				head = rhs.head;
+			}
+		};
+
+		/* Below this many nodes a subproblem isn't worth a fork. */
+		static constexpr size_type parallel_grain = 4096;
+
+		using set_native = base_ptr (tree::*)(base_ptr, base_ptr, node_list&) const;
+
+		static tree set_operation(tree&& a, tree&& b, set_native op) {
+			check_allocators(a, b);
+			tree res(std::move(a));
+			node_list dead;
+			res.root_ = (res.*op)(res.root_, b.root_, dead);
+			res.size_ = res.root_ ? res.root_->size : 0;
+			res.rethread();
+			b.root_ = nullptr;
+			b.size_ = 0;
+			b.set_ends(nullptr, nullptr);
+			/* Every list entry is the root of a dropped subtree. */
+			for (auto node = dead.head; node; ) {
+				auto next = node->parent;
+				res.destroy_subtree(node);
+				node = next;
+			}
+			return res;
+		}
+
+		template<typename F>
+		static void for_each_native(base_ptr node, const F& f) {
+			if (!node) return;
+			if (node->size <= parallel_grain) {
+				traversal<tree_node_base<T>>::in_order(node, [&f](base_ptr n) {
+					f(static_cast<const T&>(n->as_node()->data));
+				});
+				return;
+			}
+			thread_pool::instance().fork2(
+				[&]() { for_each_native(node->left, f); },
+				[&]() {
+					f(static_cast<const T&>(node->as_node()->data));
+					for_each_native(node->right, f);
+				});
+		}
+
+		/* Nothing for an empty subtree, so init isn't folded in twice. */
+		template<typename U, typename Reduce, typename Map>
+		static std::optional<U> reduce_native(base_ptr node, const Reduce& reduce, const Map& map) {
+			std::optional<U> res;
+			if (!node) return res;
+			if (node->size <= parallel_grain) {
+				traversal<tree_node_base<T>>::in_order(node, [&](base_ptr n) {
+					const T& v = n->as_node()->data;
+					if (res) {
+						res = reduce(std::move(*res), map(v));
 					}
 					else {
-						stk.push(node);
-						node = node->right;
+						res.emplace(map(v));
+					}
+				});
+				return res;
+			}
+			std::optional<U> l, r;
+			thread_pool::instance().fork2(
+				[&]() { l = reduce_native<U>(node->left, reduce, map); },
+				[&]() { r = reduce_native<U>(node->right, reduce, map); });
+			const T& v = node->as_node()->data;
+			if (l) {
+				res = reduce(std::move(*l), map(v));
+			}
+			else {
+				res.emplace(map(v));
+			}
+			if (r) {
+				res = reduce(std::move(*res), std::move(*r));
+			}
+			return res;
+		}
 
+		/* Solve both halves, on two threads if they are large enough. */
+		template<typename L, typename R>
+		static void fork_halves(size_type size, L&& left, R&& right) {
+			if (size > parallel_grain) {
+				thread_pool::instance().fork2(std::forward<L>(left), std::forward<R>(right));
+			}
+			else {
+				left();
+				right();
+			}
+		}
+
+		base_ptr union_native(base_ptr a, base_ptr b, node_list& dead) const {
+			if (!a) return b;
+			if (!b) return a;
+			size_type size = a->size + b->size;
+			base_ptr bl, br, al, ar, l, r;
+			expose(b, bl, br);
+			base_ptr found = split_native(a, b->as_node()->data, al, ar);
+			node_list dl, dr;
+			fork_halves(size,
+				[&]() { l = union_native(al, bl, dl); },
+				[&]() { r = union_native(ar, br, dr); });
+			dead.splice(dl);
+			dead.splice(dr);
+			if (found) {
+				dead.push(b);
+				return join_native(l, found, r);
+			}
+			return join_native(l, b, r);
+		}
+
+		base_ptr intersection_native(base_ptr a, base_ptr b, node_list& dead) const {
+			if (!a || !b) {
+				dead.push(a);
+				dead.push(b);
+				return nullptr;
+			}
+			size_type size = a->size + b->size;
+			base_ptr bl, br, al, ar, l, r;
+			expose(b, bl, br);
+			base_ptr found = split_native(a, b->as_node()->data, al, ar);
+			node_list dl, dr;
+			fork_halves(size,
+				[&]() { l = intersection_native(al, bl, dl); },
+				[&]() { r = intersection_native(ar, br, dr); });
+			dead.splice(dl);
+			dead.splice(dr);
+			dead.push(b);
+			return found ? join_native(l, found, r) : join2_native(l, r);
+		}
+
+		base_ptr difference_native(base_ptr a, base_ptr b, node_list& dead) const {
+			if (!a || !b) {
+				dead.push(b);
+				return a;
+			}
+			size_type size = a->size + b->size;
+			base_ptr bl, br, al, ar, l, r;
+			expose(b, bl, br);
+			base_ptr found = split_native(a, b->as_node()->data, al, ar);
+			node_list dl, dr;
+			fork_halves(size,
+				[&]() { l = difference_native(al, bl, dl); },
+				[&]() { r = difference_native(ar, br, dr); });
+			dead.splice(dl);
+			dead.splice(dr);
+			dead.push(b);
+			dead.push(found);
+			return join2_native(l, r);
+		}
+
+		template<typename ...Args>
+		node_ptr create_node(Args&&... args) {
+			stored_node* temp = node_alloc_traits::allocate(node_alloc_, 1);
+			try {
+				init_node(temp, std::forward<Args>(args)...);
+			}
+			catch (...) {
+				node_alloc_traits::deallocate(node_alloc_, temp, 1);
+				throw;
+			}
+			Stats::allocated();
+			return temp;
+		}
+
+		/* Construct a lone node in storage already allocated for it. */
+		template<typename ...Args>
+		void init_node(stored_node* temp, Args&&... args) {
+			node_alloc_traits::construct(node_alloc_, std::addressof(temp->data),
+				std::forward<Args>(args)...);
+			temp->height = 1;
+			temp->size = 1;
+			temp->left = nullptr;
+			temp->right = nullptr;
+			temp->parent = nullptr;
+			if constexpr (Threaded) {
+				temp->prev = nullptr;
+				temp->next = nullptr;
+			}
+		}
+
+		/*
+		 * The copy takes the shape of rhs node for node, heights and
+		 * sizes included, so no comparison is made and nothing needs
+		 * rebalancing. Nodes are laid out in preorder. A slab pool hands
+		 * out the whole run up front:
+		 *
+		 *        4                pool: [4][2][1][3][6][5][7]
+		 *      /   \
+		 *     2     6             a subtree is a contiguous slice
+		 *    / \   / \            starting at its root
+		 *   1   3 5   7
+		 *
+		 * Then the left subtree of a node copied to slot i takes the
+		 * slots from i + 1 and the right one those from i + 1 + the size
+		 * of the left, so subtrees larger than parallel_grain are copied
+		 * on the pool into slices of their own and no thread calls the
+		 * allocator (copy_run). With the default allocator, which any
+		 * thread may call at once, they are copied on the pool node by
+		 * node (parallel_nodes).
+		 */
+		base_ptr deep_copy(const tree& rhs) {
+			if (!rhs.root_) return nullptr;
+			if constexpr (is_slab_allocator<node_allocator>::value) {
+				if (stored_node* run = node_alloc_.allocate_run(rhs.size_)) {
+					base_ptr res;
+					try {
+						res = copy_run(rhs.root_, run);
 					}
+					catch (...) {
+						/* copy_run destroyed what it built, the blocks remain. */
+						for (size_type i = 0; i < rhs.size_; i++) {
+							node_alloc_traits::deallocate(node_alloc_, run + i, 1);
+						}
+						throw;
+					}
+					for (size_type i = 0; i < rhs.size_; i++) {
+						Stats::allocated();
+					}
+					return res;
 				}
 			}
-#endif
-#endif // DEBUG_RECURISE_MODE
-		}
-
-		void level_order_traverse(base_ptr root,
-			std::function<void(base_ptr)> func) {
-			std::queue<base_ptr> que;
-			que.push(root);
-			while (!que.empty()) {
-				auto node = que.front();
-				que.pop();
-				if (node) {
-					func(node);
-					que.push(node->left);
-					que.push(node->right);
+			base_ptr res = copy_native(rhs.root_);
+			res->parent = nullptr;
+			return res;
+		}
+
+		/*
+		 * Copy src into the preorder run starting at 'at'. A throw
+		 * destroys the elements built, but leaves the blocks to the
+		 * caller.
+		 */
+		base_ptr copy_run(base_ptr src, stored_node* at) {
+			init_node(at, src->as_node()->data);
+			base_ptr node = at;
+			node->height = src->height;
+			node->size = src->size;
+			stored_node* left_at = at + 1;
+			stored_node* right_at = left_at + (src->left ? src->left->size : 0);
+			base_ptr l = nullptr, r = nullptr;
+			try {
+				fork_halves(src->size,
+					[&]() { if (src->left) l = copy_run(src->left, left_at); },
+					[&]() { if (src->right) r = copy_run(src->right, right_at); });
+			}
+			catch (...) {
+				clear_data(l);
+				clear_data(r);
+				node_alloc_traits::destroy(node_alloc_, std::addressof(node->as_node()->data));
+				throw;
+			}
+			node->left = l;
+			node->right = r;
+			if (l) l->parent = node;
+			if (r) r->parent = node;
+			return node;
+		}
+
+		/* Nodes may be built and freed on several threads at once. */
+		static constexpr bool parallel_nodes =
+			std::is_same<node_allocator, std::allocator<stored_node>>::value;
+
+		/* A copy of src and its subtree, or nothing at all on throw. */
+		base_ptr copy_native(base_ptr src) {
+			if (!src) return nullptr;
+			if (!parallel_nodes || src->size <= parallel_grain) {
+				return copy_subtree(src);
+			}
+			base_ptr node = clone_node(src);
+			base_ptr l = nullptr, r = nullptr;
+			try {
+				thread_pool::instance().fork2(
+					[&]() { l = copy_native(src->left); },
+					[&]() { r = copy_native(src->right); });
+			}
+			catch (...) {
+				/* The half that failed cleaned up after itself. */
+				destroy_subtree(l);
+				destroy_subtree(r);
+				destroy_node(node);
+				throw;
+			}
+			node->left = l;
+			node->right = r;
+			if (l) l->parent = node;
+			if (r) r->parent = node;
+			return node;
+		}
+
+		/*
+		 * Iterative preorder copy. A frame is a source node waiting for
+		 * its copy and the copied parent to hang it on, so the stack
+		 * never holds more than one pending right child per level.
+		 * Every copy is linked at once, a throw frees what was built.
+		 */
+		base_ptr copy_subtree(base_ptr src) {
+			struct frame {
+				base_ptr src;
+				base_ptr parent;
+				bool left;
+			};
+			std::vector<frame> stack;
+			stack.reserve(src->height + 1);
+			base_ptr root = nullptr;
+			stack.push_back({ src, nullptr, false });
+			try {
+				while (!stack.empty()) {
+					frame f = stack.back();
+					stack.pop_back();
+					base_ptr node = clone_node(f.src);
+					node->parent = f.parent;
+					if (!f.parent) {
+						root = node;
+					}
+					else if (f.left) {
+						f.parent->left = node;
+					}
+					else {
+						f.parent->right = node;
+					}
+					if (f.src->right) stack.push_back({ f.src->right, node, false });
+					if (f.src->left) stack.push_back({ f.src->left, node, true });
 				}
 			}
+			catch (...) {
+				destroy_subtree(root);
+				throw;
+			}
+			return root;
+		}
+
+		/* A lone copy of src, with its height and size. */
+		base_ptr clone_node(base_ptr src) {
+			base_ptr node = create_node(src->as_node()->data);
+			node->height = src->height;
+			node->size = src->size;
+			return node;
 		}
 
-		void depth_first_search_traverse(base_ptr root,
-			std::function<void(base_ptr)> func) {
-			auto node = root;
-			std::stack<base_ptr> stk;
-			stk.push(node);
-			while (!stk.empty()) {
-				auto temp = stk.top();
-				func(temp);
-				stk.pop();
-				if (temp->right) {
-					stk.push(temp->left);
+		template<typename It>
+		bool is_sorted_unique(It first, It last) const {
+			return std::adjacent_find(first, last,
+				[this](const T& a, const T& b) { return !comp_(a, b); }) == last;
+		}
+
+		template<typename Sort>
+		void sort_unique(std::vector<T>& buf, Sort sort) const {
+			if (is_sorted_unique(buf.begin(), buf.end())) return;
+			sort(buf.begin(), buf.end(), comp_);
+			buf.erase(std::unique(buf.begin(), buf.end(),
+				[this](const T& a, const T& b) { return !comp_(a, b); }), buf.end());
+		}
+
+		/*
+		 * Sort both halves as a fork on the pool, then merge them. Pieces
+		 * too small to be worth a fork are sorted where they are.
+		 */
+		template<typename It, typename Less>
+		static void parallel_stable_sort(It first, It last, Less less) {
+			auto n = last - first;
+			if (n < (1 << 14)) {
+				std::stable_sort(first, last, less);
+				return;
+			}
+			auto mid = first + n / 2;
+			thread_pool::instance().fork2(
+				[&]() { parallel_stable_sort(first, mid, less); },
+				[&]() { parallel_stable_sort(mid, last, less); });
+			std::inplace_merge(first, mid, last, less);
+		}
+
+		struct serial_header {
+			char magic[4];
+			std::uint32_t version;
+			std::uint32_t value_size;
+			std::uint32_t reserved;
+			std::uint64_t count;
+			std::uint64_t checksum;
+		};
+
+		static constexpr std::uint32_t serial_version = 1;
+
+		/* Word-wise FNV style mixing, element by element. */
+		static std::uint64_t checksum_of(std::uint64_t h, const void* p) noexcept {
+			auto bytes = static_cast<const unsigned char*>(p);
+			size_type i = 0;
+			for (; i + 8 <= sizeof(T); i += 8) {
+				std::uint64_t w;
+				std::memcpy(&w, bytes + i, 8);
+				h = (h ^ w) * 0x100000001B3ull;
+				h ^= h >> 32;
+			}
+			if (i < sizeof(T)) {
+				std::uint64_t w = 0;
+				std::memcpy(&w, bytes + i, sizeof(T) - i);
+				h = (h ^ w) * 0x100000001B3ull;
+				h ^= h >> 32;
+			}
+			return h;
+		}
+
+		static constexpr std::uint64_t checksum_seed = 0xCBF29CE484222325ull;
+
+		serial_header make_header() const {
+			serial_header h;
+			std::memcpy(h.magic, "AVLT", 4);
+			h.version = serial_version;
+			h.value_size = sizeof(T);
+			h.reserved = 0;
+			h.count = size_;
+			h.checksum = checksum_seed;
+			for (auto it = begin(); it != end(); ++it) {
+				h.checksum = checksum_of(h.checksum, std::addressof(*it));
+			}
+			return h;
+		}
+
+		static void check_header(const serial_header& h) {
+			if (std::memcmp(h.magic, "AVLT", 4) != 0 || h.version != serial_version) {
+				throw std::runtime_error("not a tree snapshot");
+			}
+			if (h.value_size != sizeof(T)) {
+				throw std::runtime_error("tree snapshot holds another element type");
+			}
+		}
+
+		/* Verify everything, only then replace the content. */
+		void load_native(const serial_header& h, const T* data, size_type n) {
+			std::uint64_t sum = checksum_seed;
+			for (size_type i = 0; i < n; i++) {
+				sum = checksum_of(sum, data + i);
+			}
+			if (sum != h.checksum) {
+				throw std::runtime_error("tree snapshot checksum mismatch");
+			}
+			if (!is_sorted_unique(data, data + n)) {
+				throw std::runtime_error("tree snapshot is out of order");
+			}
+			assign_sorted(data, n);
+		}
+
+		template<typename It>
+		size_type insert_sorted(It first, size_type n) {
+			if (!n) return 0;
+			size_type old = size_;
+			if constexpr (Threaded) {
+				/*
+				 * Relinking every thread after the union costs O(size),
+				 * a batch that small is cheaper inserted one by one.
+				 */
+				if (root_ && n < size_ / root_->height) {
+					base_ptr hint = nullptr;
+					for (size_type i = 0; i < n; i++, ++first) {
+						hint = emplace_native(hint, *first);
+					}
+					return size_ - old;
 				}
-				if (temp->left) {
-					stk.push(temp->right);
+			}
+			reserve_nodes(n);
+			base_ptr batch = build_sorted(first, n);
+			node_list dead;
+			root_ = union_native(root_, batch, dead);
+			size_ = root_->size;
+			rethread();
+			for (auto node = dead.head; node; ) {
+				auto next = node->parent;
+				destroy_subtree(node);
+				node = next;
+			}
+			return size_ - old;
+		}
+
+		template<typename It>
+		void assign_sorted(It first, size_type n) {
+			clear();
+			reserve_nodes(n);
+			root_ = build_sorted(first, n);
+			size_ = n;
+			rethread();
+		}
+
+		/* Let a slab pool hand out the next n nodes contiguously. */
+		void reserve_nodes(size_type n) {
+			if constexpr (is_slab_allocator<node_allocator>::value) {
+				node_alloc_.reserve(n);
+			}
+		}
+
+		/*
+		 * Build a perfectly balanced subtree from the next n values of
+		 * a sorted sequence. Values are consumed in order, so 'it' only
+		 * needs to be incremented:
+		 *
+		 *   1 2 3 4 5 6 7          4
+		 *         ^              /   \
+		 *        mid            2     6
+		 *                      / \   / \
+		 *                     1   3 5   7
+		 *
+		 * The left part takes n / 2 values and the right part the rest
+		 * minus the root, so sibling sizes differ by at most one, and so
+		 * do their heights. The recursion is only log(n) deep.
+		 */
+		template<typename It>
+		base_ptr build_sorted(It& it, size_type n) {
+			if (!n) return nullptr;
+			size_type left_count = n / 2;
+			base_ptr left = build_sorted(it, left_count);
+			base_ptr node;
+			try {
+				node = create_node(*it);
+			}
+			catch (...) {
+				destroy_subtree(left);
+				throw;
+			}
+			++it;
+			base_ptr right;
+			try {
+				right = build_sorted(it, n - left_count - 1);
+			}
+			catch (...) {
+				destroy_subtree(left);
+				destroy_node(node);
+				throw;
+			}
+			node->left = left;
+			node->right = right;
+			if (left) left->parent = node;
+			if (right) right->parent = node;
+			node->update_height();
+			return node;
+		}
+
+		void destroy_subtree(base_ptr node) noexcept {
+			if (!node) return;
+			clear_node(node);
+			destroy_node(node);
+		}
+
+		void destroy_node(base_ptr node) noexcept {
+			node_alloc_traits::destroy(node_alloc_, std::addressof(node->as_node()->data));
+			node_alloc_traits::deallocate(node_alloc_, static_cast<stored_node*>(node->as_node()), 1);
+			Stats::freed();
+		}
+
+		/* Destroy the data domain of a subtree, but keep the nodes. */
+		void clear_data(base_ptr node) noexcept {
+			if (!node) return;
+			clear_data(node->left);
+			clear_data(node->right);
+			node_alloc_traits::destroy(node_alloc_, std::addressof(node->as_node()->data));
+		}
+
+		/*
+		 * Free the descendants of node. Like a copy, a large subtree is
+		 * freed half by half on the pool when the allocator allows it.
+		 */
+		void clear_node(base_ptr node) noexcept {
+			auto left = [this, node]() noexcept {
+				if (node->left) {
+					clear_node(node->left);
+					destroy_node(node->left);
+				}
+			};
+			auto right = [this, node]() noexcept {
+				if (node->right) {
+					clear_node(node->right);
+					destroy_node(node->right);
+				}
+			};
+			if (parallel_nodes && node->size > parallel_grain) {
+				try {
+					thread_pool::instance().fork2(left, right);
+					return;
+				}
+				catch (...) {
+					/* Queuing failed before either half ran. */
 				}
 			}
+			left();
+			right();
+		}
+
+	public:
+		/*
+		 * The walks of avl_traverse.hpp below any node, visit(base_ptr).
+		 * A visitor returning false stops them.
+		 */
+		template<typename Visit>
+		static bool pre_order_traverse(base_ptr root, Visit&& visit) {
+			return traversal<tree_node_base<T>>::pre_order(root, visit);
+		}
+
+		template<typename Visit>
+		static bool in_order_traverse(base_ptr root, Visit&& visit) {
+			return traversal<tree_node_base<T>>::in_order(root, visit);
+		}
+
+		template<typename Visit>
+		static bool post_order_traverse(base_ptr root, Visit&& visit) {
+			return traversal<tree_node_base<T>>::post_order(root, visit);
+		}
+
+		template<typename Visit>
+		static bool level_order_traverse(base_ptr root, Visit&& visit) {
+			return traversal<tree_node_base<T>>::level_order(root, visit);
 		}
-#endif // DEBUG_OUTPUT
 	};
 
 	/* Overload swap */
-	template<typename T>
-	void swap(tree<T>& lhs, tree<T>& rhs) {
+	template<typename T, typename C, typename A, typename S, bool H>
+	void swap(tree<T, C, A, S, H>& lhs, tree<T, C, A, S, H>& rhs) noexcept {
 		lhs.swap(rhs);
 	}
 
-	template<typename U>
-	std::ostream& operator<<(std::ostream& os, tree<U>& t)
+	/* Tree whose nodes come from its own slab pool. */
+	template<typename T, typename Compare = std::less<T>>
+	using slab_tree = tree<T, Compare, slab_allocator<T>>;
+
+	/* Tree whose nodes are linked in order, see threaded_node. */
+	template<typename T, typename Compare = std::less<T>>
+	using threaded_tree = tree<T, Compare, std::allocator<T>, no_stats, true>;
+
+	namespace pmr {
+		template<typename T, typename Compare = std::less<T>>
+		using tree = avl::tree<T, Compare, std::pmr::polymorphic_allocator<T>>;
+	}
+
+	template<typename U, typename C, typename A, typename S, bool H>
+	std::ostream& operator<<(std::ostream& os, tree<U, C, A, S, H>& t)
 	{
 #ifdef DEBUG_OUTPUT
-		t.debug_traverse(DEBUG_OUTPUT_METHOD::INORDER, [&](typename tree<U>::base_ptr node)
+		t.debug_traverse(DEBUG_OUTPUT_METHOD::INORDER, [&](typename tree<U, C, A, S, H>::base_ptr node)
 			{ os << " " << node->as_node()->data; });
 #else
-		std::queue<typename node_traits<U>::base_ptr> que;
-		que.push(t.root_);
-		while (!que.empty()) {
-			auto e = que.front();
-			que.pop();
-			if (e) {
-				os << " " << e->as_node()->data;
-				que.push(e->left);
-				que.push(e->right);
-			}
-		}
+		t.level_order_traverse(t.root_, [&](typename tree<U, C, A, S, H>::base_ptr node)
+			{ os << " " << node->as_node()->data; });
 #endif
 		os << std::endl;
 		return os;
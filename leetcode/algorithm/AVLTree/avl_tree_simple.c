@@ -81,7 +81,7 @@ NODE* simple_insert(NODE* root, NODE* node)
 		root->left = simple_insert(root->left, node);
 	}
 	else {
-		return node;
+		return root;
 	}
 
 	return simple_rebalance(root);
@@ -117,8 +117,7 @@ NODE* simple_delete(NODE* root, type key)
 		}
 	}
 	
-	simple_rebalance(root);
-	return root;
+	return simple_rebalance(root);
 }
 
 void simple_traverse(NODE* root) 
@@ -0,0 +1,399 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+
+namespace avl {
+
+	/* Operations whose latency is recorded. */
+	enum class tree_op {
+		insert,
+		erase,
+		find,
+	};
+
+	enum class rotation {
+		ll,
+		rr,
+		lr,
+		rl,
+	};
+
+	/*
+	 * Stats policy of avl::tree, the last template parameter. The tree
+	 * calls these hooks on its hot paths:
+	 *
+	 *   compared()      once per comparator call (or '<=>')
+	 *   rotated(r)      once per ll/rr/lr/rl_rotate() call, so a double
+	 *                   rotation also shows up as its two single ones
+	 *   rebalanced(n)   once per tree_rebalance(), n nodes climbed
+	 *   allocated()     once per node built, freed() once per node freed
+	 *   timer(op)       lives for one insert, erase or find
+	 *
+	 * This policy is the default and does nothing. The hooks are empty
+	 * and the tree keeps the plain comparator, so it compiles to the
+	 * same code as a tree without hooks.
+	 */
+	struct no_stats {
+		static constexpr bool enabled = false;
+
+		struct timer {
+			explicit timer(tree_op) noexcept {}
+		};
+
+		static void compared() noexcept {}
+		static void rotated(rotation) noexcept {}
+		static void rebalanced(unsigned) noexcept {}
+		static void allocated() noexcept {}
+		static void freed() noexcept {}
+	};
+
+	/*
+	 * Counters of a tree_stats at one moment. Snapshots of several
+	 * processes or policies add up with '+='.
+	 *
+	 * Histograms are indexed by the ceiling of log2: bucket i counts
+	 * values v with 2^(i-1) < v <= 2^i, bucket 0 those up to 1. The
+	 * climb histogram is linear, bucket i counts climbs of i nodes.
+	 */
+	struct tree_stats_snapshot {
+		static constexpr std::size_t ops = 3;
+		static constexpr std::size_t rotations = 4;
+		static constexpr std::size_t latency_buckets = 40;  /* up to ~9 minutes in ns */
+		static constexpr std::size_t climb_buckets = 64;    /* the last one takes the rest */
+
+		std::uint64_t comparisons = 0;
+		std::array<std::uint64_t, rotations> rotated{};
+		std::uint64_t climbs = 0;        /* tree_rebalance() calls */
+		std::uint64_t climb_nodes = 0;   /* nodes visited by them */
+		std::array<std::uint64_t, climb_buckets> climb_length{};
+		std::uint64_t allocations = 0;
+		std::uint64_t frees = 0;
+		std::array<std::uint64_t, ops> latency_count{};
+		std::array<std::uint64_t, ops> latency_sum{};    /* ns */
+		std::array<std::array<std::uint64_t, latency_buckets>, ops> latency{};
+
+		tree_stats_snapshot& operator+=(const tree_stats_snapshot& rhs) noexcept {
+			comparisons += rhs.comparisons;
+			for (std::size_t i = 0; i < rotations; i++) {
+				rotated[i] += rhs.rotated[i];
+			}
+			climbs += rhs.climbs;
+			climb_nodes += rhs.climb_nodes;
+			for (std::size_t i = 0; i < climb_buckets; i++) {
+				climb_length[i] += rhs.climb_length[i];
+			}
+			allocations += rhs.allocations;
+			frees += rhs.frees;
+			for (std::size_t op = 0; op < ops; op++) {
+				latency_count[op] += rhs.latency_count[op];
+				latency_sum[op] += rhs.latency_sum[op];
+				for (std::size_t i = 0; i < latency_buckets; i++) {
+					latency[op][i] += rhs.latency[op][i];
+				}
+			}
+			return *this;
+		}
+
+		/* Nodes alive according to the counters. */
+		std::int64_t live_nodes() const noexcept {
+			return static_cast<std::int64_t>(allocations - frees);
+		}
+
+		static std::size_t latency_bucket(std::uint64_t ns) noexcept {
+			std::size_t i = 0;
+			for (std::uint64_t v = ns > 1 ? ns - 1 : 0; v; v >>= 1) {
+				i++;
+			}
+			return i < latency_buckets ? i : latency_buckets - 1;
+		}
+
+		/*
+		 * Write the counters in the Prometheus text format, every name
+		 * starting with prefix. Histograms stop at the last bucket in
+		 * use, +Inf counts everything.
+		 */
+		void write(std::ostream& os, const char* prefix = "avl_tree") const {
+			static const char* const op_names[ops] = { "insert", "erase", "find" };
+			static const char* const rotation_names[rotations] = { "ll", "rr", "lr", "rl" };
+
+			os << "# TYPE " << prefix << "_comparisons_total counter\n"
+				<< prefix << "_comparisons_total " << comparisons << '\n';
+			os << "# TYPE " << prefix << "_rotations_total counter\n";
+			for (std::size_t i = 0; i < rotations; i++) {
+				os << prefix << "_rotations_total{kind=\"" << rotation_names[i] << "\"} "
+					<< rotated[i] << '\n';
+			}
+			os << "# TYPE " << prefix << "_allocations_total counter\n"
+				<< prefix << "_allocations_total " << allocations << '\n';
+			os << "# TYPE " << prefix << "_frees_total counter\n"
+				<< prefix << "_frees_total " << frees << '\n';
+
+			os << "# TYPE " << prefix << "_rebalance_climb_nodes histogram\n";
+			write_buckets(os, prefix, "_rebalance_climb_nodes", "",
+				climb_length.data(), climb_buckets, false);
+			os << prefix << "_rebalance_climb_nodes_sum " << climb_nodes << '\n'
+				<< prefix << "_rebalance_climb_nodes_count " << climbs << '\n';
+
+			os << "# TYPE " << prefix << "_latency_ns histogram\n";
+			for (std::size_t op = 0; op < ops; op++) {
+				write_buckets(os, prefix, "_latency_ns", op_names[op],
+					latency[op].data(), latency_buckets, true);
+				os << prefix << "_latency_ns_sum{op=\"" << op_names[op] << "\"} "
+					<< latency_sum[op] << '\n'
+					<< prefix << "_latency_ns_count{op=\"" << op_names[op] << "\"} "
+					<< latency_count[op] << '\n';
+			}
+		}
+
+	private:
+		static void write_buckets(std::ostream& os, const char* prefix, const char* name,
+			const char* op, const std::uint64_t* buckets, std::size_t n, bool log2) {
+			std::size_t used = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				if (buckets[i]) used = i;
+			}
+			std::uint64_t total = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				total += buckets[i];
+				if (i <= used && i + 1 < n) {
+					os << prefix << name << "_bucket{";
+					if (*op) os << "op=\"" << op << "\",";
+					os << "le=\"" << (log2 ? std::uint64_t(1) << i : std::uint64_t(i))
+						<< "\"} " << total << '\n';
+				}
+			}
+			os << prefix << name << "_bucket{";
+			if (*op) os << "op=\"" << op << "\",";
+			os << "le=\"+Inf\"} " << total << '\n';
+		}
+	};
+
+	/*
+	 * Stats policy that counts. Every thread bumps counters of its own,
+	 * with relaxed loads and stores only it writes, so the hot paths
+	 * never contend with other threads or wait on a lock:
+	 *
+	 *   thread 1: [block] --+
+	 *   thread 2: [block] --+--> snapshot() sums them up, plus what
+	 *   thread 3: [block] --+    threads that have exited left behind
+	 *
+	 * A thread's block is registered on its first hook and folded into
+	 * the total when the thread exits. snapshot() may be called from
+	 * any thread at any time, e.g. by a scraper that writes it out.
+	 *
+	 * Trees with the same Tag share the counters, give a tree a tag of
+	 * its own to watch it apart from the others:
+	 *
+	 *   struct index_tag;
+	 *   avl::tree<int, std::less<int>, std::allocator<int>,
+	 *       avl::tree_stats<index_tag>> index;
+	 *   avl::tree_stats<index_tag>::snapshot().write(std::cout, "index");
+	 */
+	template<typename Tag = void>
+	class tree_stats {
+		using snapshot_type = tree_stats_snapshot;
+		using counter = std::atomic<std::uint64_t>;
+
+		struct block {
+			counter comparisons{ 0 };
+			std::array<counter, snapshot_type::rotations> rotated{};
+			counter climbs{ 0 };
+			counter climb_nodes{ 0 };
+			std::array<counter, snapshot_type::climb_buckets> climb_length{};
+			counter allocations{ 0 };
+			counter frees{ 0 };
+			std::array<counter, snapshot_type::ops> latency_count{};
+			std::array<counter, snapshot_type::ops> latency_sum{};
+			std::array<std::array<counter, snapshot_type::latency_buckets>, snapshot_type::ops> latency{};
+			block* prev = nullptr;
+			block* next = nullptr;
+
+			void add_to(snapshot_type& s) const noexcept {
+				s.comparisons += load(comparisons);
+				for (std::size_t i = 0; i < snapshot_type::rotations; i++) {
+					s.rotated[i] += load(rotated[i]);
+				}
+				s.climbs += load(climbs);
+				s.climb_nodes += load(climb_nodes);
+				for (std::size_t i = 0; i < snapshot_type::climb_buckets; i++) {
+					s.climb_length[i] += load(climb_length[i]);
+				}
+				s.allocations += load(allocations);
+				s.frees += load(frees);
+				for (std::size_t op = 0; op < snapshot_type::ops; op++) {
+					s.latency_count[op] += load(latency_count[op]);
+					s.latency_sum[op] += load(latency_sum[op]);
+					for (std::size_t i = 0; i < snapshot_type::latency_buckets; i++) {
+						s.latency[op][i] += load(latency[op][i]);
+					}
+				}
+			}
+		};
+
+		/* Live blocks, and the sum of the blocks of exited threads. */
+		struct registry {
+			std::mutex mutex;
+			block* head = nullptr;
+			snapshot_type retired;
+		};
+
+		/* Registers the block of this thread for as long as it runs. */
+		struct holder {
+			block b;
+
+			holder() {
+				registry& r = get_registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				b.next = r.head;
+				if (r.head) r.head->prev = &b;
+				r.head = &b;
+			}
+
+			~holder() {
+				registry& r = get_registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				b.add_to(r.retired);
+				if (b.prev) b.prev->next = b.next;
+				else r.head = b.next;
+				if (b.next) b.next->prev = b.prev;
+			}
+		};
+
+	public:
+		static constexpr bool enabled = true;
+
+		class timer {
+		public:
+			explicit timer(tree_op op) noexcept :
+				op_(static_cast<std::size_t>(op)),
+				start_(std::chrono::steady_clock::now()) {}
+
+			timer(const timer&) = delete;
+			timer& operator=(const timer&) = delete;
+
+			~timer() {
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - start_).count();
+				std::uint64_t v = ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+				block& b = local();
+				bump(b.latency_count[op_]);
+				bump(b.latency_sum[op_], v);
+				bump(b.latency[op_][snapshot_type::latency_bucket(v)]);
+			}
+
+		private:
+			std::size_t op_;
+			std::chrono::steady_clock::time_point start_;
+		};
+
+		static void compared() noexcept {
+			bump(local().comparisons);
+		}
+
+		static void rotated(rotation r) noexcept {
+			bump(local().rotated[static_cast<std::size_t>(r)]);
+		}
+
+		static void rebalanced(unsigned nodes) noexcept {
+			block& b = local();
+			bump(b.climbs);
+			bump(b.climb_nodes, nodes);
+			bump(b.climb_length[nodes < snapshot_type::climb_buckets ?
+				nodes : snapshot_type::climb_buckets - 1]);
+		}
+
+		static void allocated() noexcept {
+			bump(local().allocations);
+		}
+
+		static void freed() noexcept {
+			bump(local().frees);
+		}
+
+		/* Counters of every thread so far, exited ones included. */
+		static snapshot_type snapshot() {
+			registry& r = get_registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			snapshot_type s = r.retired;
+			for (block* b = r.head; b; b = b->next) {
+				b->add_to(s);
+			}
+			return s;
+		}
+
+		/* Counters of the calling thread only. */
+		static snapshot_type thread_snapshot() {
+			snapshot_type s;
+			local().add_to(s);
+			return s;
+		}
+
+	private:
+		static registry& get_registry() {
+			static registry r;
+			return r;
+		}
+
+		static block& local() noexcept {
+			thread_local holder h;
+			return h.b;
+		}
+
+		static std::uint64_t load(const counter& c) noexcept {
+			return c.load(std::memory_order_relaxed);
+		}
+
+		/* Only the owner thread writes, so no read-modify-write is needed. */
+		static void bump(counter& c, std::uint64_t n = 1) noexcept {
+			c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+	};
+
+	/*
+	 * The comparator a counting tree keeps: it forwards to Compare and
+	 * tells the policy about every call. It derives from Compare when
+	 * it can, so the members of Compare (is_transparent, or the key
+	 * comparator of a map) stay reachable and it converts back to
+	 * Compare by slicing.
+	 */
+	template<typename Compare, typename Stats,
+		bool = std::is_class<Compare>::value && !std::is_final<Compare>::value>
+	struct counted_compare : Compare {
+		counted_compare() = default;
+
+		counted_compare(const Compare& comp) :
+			Compare(comp) {}
+
+		template<typename A, typename B>
+		bool operator()(const A& a, const B& b) const {
+			Stats::compared();
+			return static_cast<const Compare&>(*this)(a, b);
+		}
+	};
+
+	template<typename Compare, typename Stats>
+	struct counted_compare<Compare, Stats, false> {
+		counted_compare() = default;
+
+		counted_compare(const Compare& comp) :
+			comp(comp) {}
+
+		operator Compare() const {
+			return comp;
+		}
+
+		template<typename A, typename B>
+		bool operator()(const A& a, const B& b) const {
+			Stats::compared();
+			return comp(a, b);
+		}
+
+		Compare comp;
+	};
+}
@@ -0,0 +1,35 @@
+#ifndef BENCH_ENGINES_H
+#define BENCH_ENGINES_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every engine is driven through the same table of functions on int
+ * keys, so each one pays the same indirect call per operation.
+ */
+typedef struct BENCH_ENGINE {
+	const char* name;
+	void* (*create)(void);
+	void  (*destroy)(void* tree);
+	void  (*insert)(void* tree, int key);
+	int   (*erase)(void* tree, int key);    /* 1 if key was there */
+	int   (*contains)(void* tree, int key);
+} BENCH_ENGINE;
+
+extern const BENCH_ENGINE bench_avl_tree_c;      /* avl_tree.c */
+extern const BENCH_ENGINE bench_avl_tree_simple; /* avl_tree_simple.c */
+extern const BENCH_ENGINE bench_rb_tree_simple;  /* rb_tree_simple.c */
+
+/* Every engine allocates through these, so its footprint is known. */
+void* bench_malloc(size_t size);
+void  bench_free(void* p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ * Benchmark of the ordered set engines under algorithm/, against
+ * std::set, on int keys. For every engine, workload and size it times
+ * each phase and prints one JSON document on stdout:
+ *
+ *   { "benchmark": "trees", "seed": 1, "results": [
+ *     { "engine": "avl_tree", "workload": "random", "size": 1000,
+ *       "phase": "insert", "ops": 1000, "seconds": ..., "ops_per_sec": ...,
+ *       "ns_per_op": ..., "bytes_per_element": ..., "checksum": ...,
+ *       "verified": true }, ... ] }
+ *
+ * Workloads:
+ *   sequential    insert 0..n-1 ascending, find them all, erase them all
+ *   random        insert n random keys, find n keys (half of them hits),
+ *                 erase the inserted keys in another random order
+ *   zipfian       insert n random keys, find n keys drawn from them with
+ *                 a Zipf(0.99) skew, the way YCSB does it
+ *   delete_heavy  insert n random keys, then n operations: 3 in 4 erase
+ *                 a random earlier key, 1 in 4 inserts a new one
+ *
+ * bytes_per_element is what the engine holds from the heap once the
+ * first phase is done, over the number of elements. The checksum is
+ * the number of finds and erases that hit, which every engine must
+ * agree on, else "verified" is false and the exit status is 1.
+ *
+ *   bench_trees [--sizes=1000,10000] [--engines=avl_tree,std_set]
+ *               [--workloads=random,zipfian] [--seed=1] [--repeat=1]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include "bench_engines.h"
+/* The iterators of avl_tree_plus.hpp still derive from std::iterator. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include "../AVLTree/avl_tree_plus.hpp"
+#pragma GCC diagnostic pop
+
+/*
+ * Live heap bytes, as the allocator really hands them out, so node
+ * headers and rounding count too. C engines come through
+ * bench_malloc(), C++ ones through operator new.
+ */
+static std::atomic<std::size_t> live_bytes{ 0 };
+
+extern "C" void* bench_malloc(size_t size)
+{
+	void* p = std::malloc(size);
+	if (p) live_bytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+	return p;
+}
+
+extern "C" void bench_free(void* p)
+{
+	if (!p) return;
+	live_bytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+	std::free(p);
+}
+
+void* operator new(std::size_t size)
+{
+	void* p = bench_malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	bench_free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	bench_free(p);
+}
+
+namespace {
+
+	/* The C++ engines, behind the same table as the C ones. */
+	template<typename Set>
+	struct cxx_engine {
+		static void* create() {
+			return new Set();
+		}
+
+		static void destroy(void* t) {
+			delete static_cast<Set*>(t);
+		}
+
+		static void insert(void* t, int key) {
+			static_cast<Set*>(t)->insert(key);
+		}
+
+		static int erase(void* t, int key) {
+			auto s = static_cast<Set*>(t);
+			auto it = s->find(key);
+			if (it == s->end()) return 0;
+			s->erase(it);
+			return 1;
+		}
+
+		static int contains(void* t, int key) {
+			auto s = static_cast<Set*>(t);
+			return s->find(key) != s->end();
+		}
+
+		static BENCH_ENGINE table(const char* name) {
+			return { name, create, destroy, insert, erase, contains };
+		}
+	};
+
+	const BENCH_ENGINE bench_avl_tree = cxx_engine<avl::tree<int>>::table("avl_tree");
+	const BENCH_ENGINE bench_avl_threaded = cxx_engine<avl::threaded_tree<int>>::table("avl_threaded");
+	const BENCH_ENGINE bench_std_set = cxx_engine<std::set<int>>::table("std_set");
+
+	const BENCH_ENGINE* const all_engines[] = {
+		&bench_avl_tree,
+		&bench_avl_threaded,
+		&bench_avl_tree_c,
+		&bench_avl_tree_simple,
+		&bench_rb_tree_simple,
+		&bench_std_set,
+	};
+
+	/*
+	 * Zipf over [0, n) after Gray et al., "Quickly Generating
+	 * Billion-Record Synthetic Databases", as YCSB uses it. Rank 0 is
+	 * the hottest.
+	 */
+	class zipf_generator {
+	public:
+		zipf_generator(std::uint64_t n, double theta) :
+			n_(n),
+			theta_(theta) {
+			double zeta2 = zeta(2, theta);
+			zetan_ = zeta(n, theta);
+			alpha_ = 1.0 / (1.0 - theta);
+			eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+		}
+
+		template<typename Rng>
+		std::uint64_t operator()(Rng& rng) {
+			double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+			double uz = u * zetan_;
+			if (uz < 1.0) return 0;
+			if (uz < 1.0 + std::pow(0.5, theta_)) return n_ > 1 ? 1 : 0;
+			auto res = static_cast<std::uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+			return res < n_ ? res : n_ - 1;
+		}
+
+	private:
+		static double zeta(std::uint64_t n, double theta) {
+			double sum = 0;
+			for (std::uint64_t i = 1; i <= n; i++) {
+				sum += 1.0 / std::pow(static_cast<double>(i), theta);
+			}
+			return sum;
+		}
+
+		std::uint64_t n_;
+		double theta_;
+		double zetan_;
+		double alpha_;
+		double eta_;
+	};
+
+	enum class op_kind { insert, erase, find };
+
+	struct op {
+		op_kind kind;
+		int key;
+	};
+
+	/* A phase is a fixed list of operations, generated before timing. */
+	struct phase {
+		std::string name;
+		std::vector<op> ops;
+	};
+
+	/* Distinct random keys, in random order. */
+	std::vector<int> random_keys(std::size_t n, std::mt19937_64& rng) {
+		std::vector<int> keys;
+		keys.reserve(n + n / 8);
+		std::uniform_int_distribution<int> dist(0, 0x7fffffff);
+		while (keys.size() < n) {
+			while (keys.size() < n + n / 8) {
+				keys.push_back(dist(rng));
+			}
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		}
+		std::shuffle(keys.begin(), keys.end(), rng);
+		keys.resize(n);
+		return keys;
+	}
+
+	phase make_phase(const char* name, op_kind kind, const std::vector<int>& keys) {
+		phase res{ name, {} };
+		res.ops.reserve(keys.size());
+		for (int k : keys) {
+			res.ops.push_back({ kind, k });
+		}
+		return res;
+	}
+
+	std::vector<phase> make_workload(const std::string& name, std::size_t n, std::uint64_t seed) {
+		std::mt19937_64 rng(seed ^ (n * 0x9E3779B97F4A7C15ull));
+		std::vector<phase> res;
+		if (name == "sequential") {
+			std::vector<int> keys(n);
+			for (std::size_t i = 0; i < n; i++) {
+				keys[i] = static_cast<int>(i);
+			}
+			res.push_back(make_phase("insert", op_kind::insert, keys));
+			res.push_back(make_phase("find", op_kind::find, keys));
+			res.push_back(make_phase("erase", op_kind::erase, keys));
+		}
+		else if (name == "random") {
+			std::vector<int> keys = random_keys(2 * n, rng);
+			std::vector<int> inserted(keys.begin(), keys.begin() + n);
+			res.push_back(make_phase("insert", op_kind::insert, inserted));
+			/* Present and absent keys, shuffled together. */
+			std::shuffle(keys.begin(), keys.end(), rng);
+			keys.resize(n);
+			res.push_back(make_phase("find", op_kind::find, keys));
+			std::shuffle(inserted.begin(), inserted.end(), rng);
+			res.push_back(make_phase("erase", op_kind::erase, inserted));
+		}
+		else if (name == "zipfian") {
+			std::vector<int> keys = random_keys(n, rng);
+			res.push_back(make_phase("insert", op_kind::insert, keys));
+			zipf_generator zipf(n, 0.99);
+			phase find{ "find", {} };
+			find.ops.reserve(n);
+			for (std::size_t i = 0; i < n; i++) {
+				find.ops.push_back({ op_kind::find, keys[zipf(rng)] });
+			}
+			res.push_back(std::move(find));
+		}
+		else if (name == "delete_heavy") {
+			std::vector<int> keys = random_keys(2 * n, rng);
+			std::vector<int> inserted(keys.begin(), keys.begin() + n);
+			res.push_back(make_phase("insert", op_kind::insert, inserted));
+			phase mixed{ "mixed", {} };
+			mixed.ops.reserve(n);
+			std::size_t fresh = n;
+			for (std::size_t i = 0; i < n; i++) {
+				if (rng() % 4) {
+					mixed.ops.push_back({ op_kind::erase, keys[rng() % fresh] });
+				}
+				else {
+					mixed.ops.push_back({ op_kind::insert, keys[fresh++] });
+				}
+			}
+			res.push_back(std::move(mixed));
+		}
+		return res;
+	}
+
+	struct result {
+		std::string engine;
+		std::string workload;
+		std::size_t size;
+		std::string phase;
+		std::size_t ops;
+		double seconds;
+		double bytes_per_element;
+		std::uint64_t checksum;
+		bool verified;
+	};
+
+	std::size_t run_phase(const BENCH_ENGINE& e, void* t, const phase& p) {
+		std::size_t hits = 0;
+		for (const op& o : p.ops) {
+			switch (o.kind) {
+			case op_kind::insert:
+				e.insert(t, o.key);
+				break;
+			case op_kind::erase:
+				hits += e.erase(t, o.key);
+				break;
+			default:
+				hits += e.contains(t, o.key);
+				break;
+			}
+		}
+		return hits;
+	}
+
+	/*
+	 * Run one engine over a workload repeat times on a fresh tree and
+	 * keep the fastest time of each phase.
+	 */
+	void run(const BENCH_ENGINE& e, const std::string& workload, std::size_t n,
+		const std::vector<phase>& phases, int repeat, std::vector<result>& out) {
+		std::vector<result> best;
+		for (int r = 0; r < repeat; r++) {
+			std::size_t base = live_bytes.load();
+			void* t = e.create();
+			for (std::size_t i = 0; i < phases.size(); i++) {
+				auto start = std::chrono::steady_clock::now();
+				std::size_t hits = run_phase(e, t, phases[i]);
+				double secs = std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+				if (!r) {
+					double bytes = i == 0 ? static_cast<double>(live_bytes.load() - base) / n : 0;
+					best.push_back({ e.name, workload, n, phases[i].name, phases[i].ops.size(),
+						secs, bytes, hits, true });
+				}
+				else {
+					best[i].seconds = std::min(best[i].seconds, secs);
+				}
+			}
+			e.destroy(t);
+		}
+		/* The first phase of a workload sets the footprint of all of it. */
+		for (auto& res : best) {
+			res.bytes_per_element = best[0].bytes_per_element;
+			out.push_back(res);
+		}
+	}
+
+	std::vector<std::string> split(const std::string& s) {
+		std::vector<std::string> res;
+		std::size_t pos = 0;
+		while (pos <= s.size()) {
+			std::size_t next = s.find(',', pos);
+			if (next == std::string::npos) next = s.size();
+			if (next > pos) res.push_back(s.substr(pos, next - pos));
+			pos = next + 1;
+		}
+		return res;
+	}
+
+	bool option(const char* arg, const char* name, std::string& value) {
+		std::size_t len = std::strlen(name);
+		if (std::strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+		value = arg + len + 1;
+		return true;
+	}
+
+	void usage() {
+		std::fprintf(stderr,
+			"usage: bench_trees [--sizes=N,...] [--engines=NAME,...] [--workloads=NAME,...]\n"
+			"                   [--seed=N] [--repeat=N]\n"
+			"engines:   avl_tree avl_threaded avl_tree_c avl_tree_simple rb_tree_simple std_set\n"
+			"workloads: sequential random zipfian delete_heavy\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::size_t> sizes = { 1000, 10000, 100000, 1000000 };
+	std::vector<std::string> engines;
+	for (auto e : all_engines) {
+		engines.push_back(e->name);
+	}
+	std::vector<std::string> workloads = { "sequential", "random", "zipfian", "delete_heavy" };
+	std::uint64_t seed = 1;
+	int repeat = 1;
+
+	for (int i = 1; i < argc; i++) {
+		std::string value;
+		if (option(argv[i], "--sizes", value)) {
+			sizes.clear();
+			for (auto& s : split(value)) {
+				sizes.push_back(static_cast<std::size_t>(std::strtod(s.c_str(), nullptr)));
+			}
+		}
+		else if (option(argv[i], "--engines", value)) {
+			engines = split(value);
+		}
+		else if (option(argv[i], "--workloads", value)) {
+			workloads = split(value);
+		}
+		else if (option(argv[i], "--seed", value)) {
+			seed = std::strtoull(value.c_str(), nullptr, 10);
+		}
+		else if (option(argv[i], "--repeat", value)) {
+			repeat = std::max(1, std::atoi(value.c_str()));
+		}
+		else {
+			usage();
+			return 2;
+		}
+	}
+
+	std::vector<const BENCH_ENGINE*> chosen;
+	for (auto& name : engines) {
+		auto it = std::find_if(std::begin(all_engines), std::end(all_engines),
+			[&](const BENCH_ENGINE* e) { return name == e->name; });
+		if (it == std::end(all_engines)) {
+			std::fprintf(stderr, "unknown engine %s\n", name.c_str());
+			usage();
+			return 2;
+		}
+		chosen.push_back(*it);
+	}
+	for (auto& w : workloads) {
+		if (w != "sequential" && w != "random" && w != "zipfian" && w != "delete_heavy") {
+			std::fprintf(stderr, "unknown workload %s\n", w.c_str());
+			usage();
+			return 2;
+		}
+	}
+
+	std::vector<result> results;
+	bool all_verified = true;
+	for (auto& w : workloads) {
+		for (std::size_t n : sizes) {
+			if (!n) continue;
+			std::vector<phase> phases = make_workload(w, n, seed);
+			std::size_t first = results.size();
+			for (auto e : chosen) {
+				std::fprintf(stderr, "%s %s %zu\n", e->name, w.c_str(), n);
+				run(*e, w, n, phases, repeat, results);
+			}
+			/* Every engine must hit as often as the first one. */
+			for (std::size_t i = first; i < results.size(); i++) {
+				std::size_t ref = first + (i - first) % phases.size();
+				if (results[i].checksum != results[ref].checksum) {
+					results[i].verified = false;
+					all_verified = false;
+					std::fprintf(stderr, "mismatch: %s %s %zu %s\n", results[i].engine.c_str(),
+						w.c_str(), n, results[i].phase.c_str());
+				}
+			}
+		}
+	}
+
+	std::printf("{\n  \"benchmark\": \"trees\",\n  \"seed\": %llu,\n  \"results\": [",
+		static_cast<unsigned long long>(seed));
+	for (std::size_t i = 0; i < results.size(); i++) {
+		const result& r = results[i];
+		double secs = r.seconds > 0 ? r.seconds : 1e-9;
+		std::printf("%s\n    { \"engine\": \"%s\", \"workload\": \"%s\", \"size\": %zu, "
+			"\"phase\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+			"\"ns_per_op\": %.2f, \"bytes_per_element\": %.2f, \"checksum\": %llu, "
+			"\"verified\": %s }",
+			i ? "," : "", r.engine.c_str(), r.workload.c_str(), r.size, r.phase.c_str(),
+			r.ops, r.seconds, r.ops / secs, secs * 1e9 / r.ops, r.bytes_per_element,
+			static_cast<unsigned long long>(r.checksum), r.verified ? "true" : "false");
+	}
+	std::printf("\n  ]\n}\n");
+	return all_verified ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+/*
+ * The recursive AVL of avl_tree_simple.c. The caller owns its nodes,
+ * one bench_malloc() each. simple_delete() doesn't hand the unlinked
+ * node back, so the engine finds it first: the node holding the key,
+ * or its successor when it has two children, whose key is copied over
+ * before the successor is unlinked. Neither call tells whether the
+ * key was there, so both search first, which this engine pays on top
+ * of its own descent.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_engines.h"
+
+#define main avl_tree_simple_demo
+#include "../AVLTree/avl_tree_simple.c"
+#undef main
+
+typedef struct {
+	NODE* root;
+} BENCH_SIMPLE;
+
+static void* bench_create(void)
+{
+	BENCH_SIMPLE* t = (BENCH_SIMPLE*)bench_malloc(sizeof(BENCH_SIMPLE));
+	t->root = NULL;
+	return t;
+}
+
+static void bench_free_nodes(NODE* node)
+{
+	if (!node) return;
+	bench_free_nodes(node->left);
+	bench_free_nodes(node->right);
+	bench_free(node);
+}
+
+static void bench_destroy(void* tree)
+{
+	BENCH_SIMPLE* t = (BENCH_SIMPLE*)tree;
+	bench_free_nodes(t->root);
+	bench_free(t);
+}
+
+static NODE* bench_find(NODE* node, int key)
+{
+	while (node) {
+		if (key < node->key) {
+			node = node->left;
+		}
+		else if (node->key < key) {
+			node = node->right;
+		}
+		else {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+static int bench_contains(void* tree, int key)
+{
+	return bench_find(((BENCH_SIMPLE*)tree)->root, key) != NULL;
+}
+
+static void bench_insert(void* tree, int key)
+{
+	BENCH_SIMPLE* t = (BENCH_SIMPLE*)tree;
+	if (bench_find(t->root, key)) return;
+	NODE* node = (NODE*)bench_malloc(sizeof(NODE));
+	node->key = key;
+	node->height = 1;
+	node->left = NULL;
+	node->right = NULL;
+	t->root = simple_insert(t->root, node);
+}
+
+static int bench_erase(void* tree, int key)
+{
+	BENCH_SIMPLE* t = (BENCH_SIMPLE*)tree;
+	NODE* node = bench_find(t->root, key);
+	if (!node) return 0;
+	if (node->left && node->right) {
+		node = node->right;
+		while (node->left) {
+			node = node->left;
+		}
+	}
+	t->root = simple_delete(t->root, key);
+	bench_free(node);
+	return 1;
+}
+
+const BENCH_ENGINE bench_avl_tree_simple = {
+	"avl_tree_simple",
+	bench_create,
+	bench_destroy,
+	bench_insert,
+	bench_erase,
+	bench_contains,
+};
@@ -0,0 +1,113 @@
+/*
+ * The intrusive AVL of avl_tree.c. The key lives next to the embedded
+ * AVL_NODE, the same way its test code does it.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_engines.h"
+
+#define malloc(n) bench_malloc(n)
+#define free(p)   bench_free(p)
+#include "../AVLTree/avl_tree.c"
+#undef malloc
+#undef free
+
+typedef struct {
+	AVL_NODE node;
+	int key;
+} BENCH_ITEM;
+
+typedef struct {
+	AVL_TREE root;
+} BENCH_AVL;
+
+static int bench_compare(void* p, GENERIC_KEY u)
+{
+	BENCH_ITEM* item = (BENCH_ITEM*)p;
+	if (item->key < u.i)
+		return AVL_NODE_KEY_BIG;
+	else if (item->key > u.i)
+		return AVL_NODE_KEY_SMALL;
+	else
+		return AVL_NODE_KEY_EQUAL;
+}
+
+static void* bench_create(void)
+{
+	BENCH_AVL* t = (BENCH_AVL*)bench_malloc(sizeof(BENCH_AVL));
+	t->root = NULL;
+	return t;
+}
+
+static void bench_destroy_node(AVL_NODE* node)
+{
+	if (!node) return;
+	bench_destroy_node((AVL_NODE*)node->left);
+	bench_destroy_node((AVL_NODE*)node->right);
+	bench_free(AVL_TREE_ENTRY(node, BENCH_ITEM, node));
+}
+
+static void bench_destroy(void* tree)
+{
+	BENCH_AVL* t = (BENCH_AVL*)tree;
+	bench_destroy_node(t->root);
+	bench_free(t);
+}
+
+/*
+ * avl_insert() doesn't say whether it linked the node. It sets the
+ * height of a linked node to 1, so a height still 0 means a duplicate.
+ */
+static void bench_insert(void* tree, int key)
+{
+	BENCH_AVL* t = (BENCH_AVL*)tree;
+	BENCH_ITEM* item = (BENCH_ITEM*)bench_malloc(sizeof(BENCH_ITEM));
+	GENERIC_KEY k;
+	k.i = key;
+	item->key = key;
+	item->node.height = 0;
+	avl_insert(&t->root, item, k, bench_compare);
+	if (!item->node.height) {
+		bench_free(item);
+	}
+}
+
+static int bench_erase(void* tree, int key)
+{
+	BENCH_AVL* t = (BENCH_AVL*)tree;
+	GENERIC_KEY k;
+	k.i = key;
+	void* deleted = avl_delete(&t->root, k, bench_compare);
+	if (!deleted) return 0;
+	bench_free(AVL_TREE_ENTRY(deleted, BENCH_ITEM, node));
+	return 1;
+}
+
+/* avl_tree.c has no search of its own. */
+static int bench_contains(void* tree, int key)
+{
+	AVL_NODE* node = ((BENCH_AVL*)tree)->root;
+	while (node) {
+		int k = AVL_TREE_ENTRY(node, BENCH_ITEM, node)->key;
+		if (key < k) {
+			node = (AVL_NODE*)node->left;
+		}
+		else if (k < key) {
+			node = (AVL_NODE*)node->right;
+		}
+		else {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+const BENCH_ENGINE bench_avl_tree_c = {
+	"avl_tree_c",
+	bench_create,
+	bench_destroy,
+	bench_insert,
+	bench_erase,
+	bench_contains,
+};
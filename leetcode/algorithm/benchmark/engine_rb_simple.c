@@ -0,0 +1,47 @@
+/* The red-black tree of rb_tree_simple.c, which allocates its own nodes. */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_engines.h"
+
+#define malloc(n) bench_malloc(n)
+#define free(p)   bench_free(p)
+#define main rb_tree_simple_demo
+#include "../RBTree/rb_tree_simple.c"
+#undef main
+#undef malloc
+#undef free
+
+static void* bench_create(void)
+{
+	return simple_rb_tree_create();
+}
+
+static void bench_destroy(void* tree)
+{
+	simple_rb_destroy((TREE*)tree);
+}
+
+static void bench_insert(void* tree, int key)
+{
+	simple_rb_insert((TREE*)tree, key);
+}
+
+static int bench_erase(void* tree, int key)
+{
+	return simple_rb_remove((TREE*)tree, key) == 0;
+}
+
+static int bench_contains(void* tree, int key)
+{
+	return simple_rb_find((TREE*)tree, key) != ((TREE*)tree)->nil;
+}
+
+const BENCH_ENGINE bench_rb_tree_simple = {
+	"rb_tree_simple",
+	bench_create,
+	bench_destroy,
+	bench_insert,
+	bench_erase,
+	bench_contains,
+};